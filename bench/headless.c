@@ -0,0 +1,688 @@
+// headless physics benchmark. builds a world of each requested size from a
+// fixed seed, steps it with a fixed timestep and reports throughput and step
+// latency percentiles as csv or json. with --render every step is also packed
+// into a draw list and handed to the null render backend, timed apart from the
+// step. no window is ever opened, so it runs fine on machines without a display.
+// --verify and --verify-changes run self checks instead, for ctest.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "ecs.h"
+#include "systems.h"
+#include "collision.h"
+#include "physics_kernel.h"
+#include "thread_pool.h"
+#include "render_snapshot.h"
+#include "render_backend.h"
+#include "perf_counters.h"
+#include "recording.h"
+
+#define DEFAULT_SEED 0x5eedu
+#define DEFAULT_WARMUP_STEPS 30
+#define DEFAULT_STEPS 300
+#define FIXED_DELTA_TIME (1.f / 60.f)
+
+// the demo runs 1000 entities in a 512x512 window. worlds are scaled so
+// every size keeps that density.
+#define REFERENCE_ENTITY_COUNT 1000.f
+#define REFERENCE_WORLD_SIZE 512.f
+
+#define VERIFY_STEPS 10
+
+// how far a batched kernel may drift from the scalar reference over
+// VERIFY_STEPS steps, in pixels for positions and pixels per second for
+// velocities. float rounding alone stays orders of magnitude below this
+#define VERIFY_TOLERANCE 1e-2f
+
+// world size and scratch recording for --verify-changes, which stays well
+// under the recorder's ring so no capture is dropped
+#define VERIFY_CHANGES_ENTITIES 1000
+#define VERIFY_CHANGES_STEPS 5
+#define VERIFY_CHANGES_PATH "verify_changes.rec"
+
+typedef enum {
+    OUTPUT_CSV = 0,
+    OUTPUT_JSON,
+} OutputFormat;
+
+typedef struct {
+    size_t          entity_counts[16];
+    size_t          entity_count_count;
+    size_t          warmup_steps;
+    size_t          steps;
+    uint64_t        seed;
+    size_t          worker_count;
+    int             collisions;
+    int             huge_pages;
+    int             render;
+    int             verify;
+    int             verify_changes;
+    OutputFormat    format;
+} BenchConfig;
+
+typedef struct {
+    size_t      entity_count;
+    size_t      steps;
+    double      steps_per_sec;
+    double      ns_per_entity;
+    double      p50_us;
+    double      p90_us;
+    double      p99_us;
+    double      max_us;
+    double      checksum;
+    float       kernel_max_error;
+    double      extract_us;         // mean per step, 0 without --render
+    double      submit_us;
+    double      bytes_per_entity;   // committed world memory over live entities
+} BenchResult;
+
+static uint64_t s_rng_state;
+
+static int _parse_args(int argc, char** argv, BenchConfig* o_config);
+static int _run(const BenchConfig* config, ThreadPool* pool, const size_t entity_count, BenchResult* o_result);
+static EcsWorld* _create_world(const EcsConfig* ecs_config, const size_t entity_count, const Vec2 bounds);
+static void _init_world_batch(void* context, const EcsSpawnBatch* batch);
+static float _verify_kernel(EcsWorld* world, const size_t body_count, const Vec2 bounds);
+static int _verify_kernels(const BenchConfig* config);
+static int _verify_changes(const BenchConfig* config);
+static size_t _count_changed(const EcsWorld* world, const ComponentType type, const EcsVersion since, const EntityID entity, int* o_found);
+static int _verify_replay(EcsWorld* world, const size_t frame_count);
+static int _report(const char* check, const int passed);
+static double _checksum(EcsWorld* world);
+static void _print_result(const BenchConfig* config, const BenchResult* result, const size_t index);
+static int _compare_u64(const void* a, const void* b);
+static uint64_t _now_ns(void);
+static void _rand_seed(uint64_t seed);
+static uint32_t _rand_u32(void);
+static float _frand_range(float min, float max);
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    if (! _parse_args(argc, argv, &config))
+        return 1;
+
+    if (config.verify)
+        return _verify_kernels(&config) ? 0 : 1;
+
+    if (config.verify_changes)
+        return _verify_changes(&config) ? 0 : 1;
+
+    ThreadPool* pool = thread_pool_create(config.worker_count);
+    if (pool == NULL) {
+        fprintf(stderr, "ERROR: failed to create worker pool\n");
+        return 1;
+    }
+
+    if (config.format == OUTPUT_CSV)
+        printf("entities,steps,steps_per_sec,ns_per_entity,p50_us,p90_us,p99_us,max_us,checksum,kernel,kernel_max_error,workers,collisions,extract_us,submit_us,bytes_per_entity\n");
+    else
+        printf("{\"kernel\":\"%s\",\"workers\":%zu,\"collisions\":%d,\"render\":%d,\"seed\":%llu,\"results\":[\n",
+            physics_kernel_name(), config.worker_count, config.collisions, config.render, (unsigned long long)config.seed);
+
+    int ok = 1;
+    for (size_t i = 0; i < config.entity_count_count && ok; ++i) {
+        BenchResult result;
+        ok = _run(&config, pool, config.entity_counts[i], &result);
+        if (ok)
+            _print_result(&config, &result, i);
+    }
+
+    if (config.format == OUTPUT_JSON)
+        printf("\n]}\n");
+
+    thread_pool_destroy(pool);
+    return ok ? 0 : 1;
+}
+
+static int _parse_args(int argc, char** argv, BenchConfig* o_config) {
+    *o_config = (BenchConfig) {
+        .entity_counts      = { 1000, 10000, 100000, 1000000 },
+        .entity_count_count = 4,
+        .warmup_steps       = DEFAULT_WARMUP_STEPS,
+        .steps              = DEFAULT_STEPS,
+        .seed               = DEFAULT_SEED,
+        .worker_count       = thread_pool_default_worker_count(),
+        .collisions         = 0,
+        .huge_pages         = 0,
+        .render             = 0,
+        .verify             = 0,
+        .verify_changes     = 0,
+        .format             = OUTPUT_CSV,
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--json") == 0) {
+            o_config->format = OUTPUT_JSON;
+        } else if (strcmp(arg, "--csv") == 0) {
+            o_config->format = OUTPUT_CSV;
+        } else if (strcmp(arg, "--collisions") == 0) {
+            o_config->collisions = 1;
+        } else if (strcmp(arg, "--huge-pages") == 0) {
+            o_config->huge_pages = 1;
+        } else if (strcmp(arg, "--render") == 0) {
+            o_config->render = 1;
+        } else if (strcmp(arg, "--verify") == 0) {
+            o_config->verify = 1;
+        } else if (strcmp(arg, "--verify-changes") == 0) {
+            o_config->verify_changes = 1;
+        } else if (strcmp(arg, "--steps") == 0 && value != NULL) {
+            o_config->steps = strtoull(value, NULL, 10);
+            ++i;
+        } else if (strcmp(arg, "--warmup") == 0 && value != NULL) {
+            o_config->warmup_steps = strtoull(value, NULL, 10);
+            ++i;
+        } else if (strcmp(arg, "--seed") == 0 && value != NULL) {
+            o_config->seed = strtoull(value, NULL, 0);
+            ++i;
+        } else if (strcmp(arg, "--workers") == 0 && value != NULL) {
+            o_config->worker_count = strtoull(value, NULL, 10);
+            ++i;
+        } else if (strcmp(arg, "--counts") == 0 && value != NULL) {
+            // comma separated list, e.g. --counts 1000,50000
+            o_config->entity_count_count = 0;
+            const char* cursor = value;
+            while (*cursor != '\0' && o_config->entity_count_count < 16) {
+                char* end = NULL;
+                o_config->entity_counts[o_config->entity_count_count++] = strtoull(cursor, &end, 10);
+                cursor = *end == ',' ? end + 1 : end;
+            }
+            ++i;
+        } else {
+            fprintf(stderr, "usage: %s [--csv|--json] [--counts N,N,...] [--steps N] [--warmup N] "
+                "[--seed N] [--workers N] [--collisions] [--huge-pages] [--render] [--verify] [--verify-changes]\n", argv[0]);
+            return 0;
+        }
+    }
+
+    if (o_config->steps == 0 || o_config->entity_count_count == 0) {
+        fprintf(stderr, "ERROR: need at least one step and one entity count\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int _run(const BenchConfig* config, ThreadPool* pool, const size_t entity_count, BenchResult* o_result) {
+    const float world_size = REFERENCE_WORLD_SIZE * sqrtf(entity_count / REFERENCE_ENTITY_COUNT);
+    const Vec2 bounds = { .x = world_size, .y = world_size };
+
+    uint64_t* step_ns = malloc(sizeof(uint64_t)*config->steps);
+    CollisionGrid* grid = config->collisions ? collision_grid_create() : NULL;
+    RenderBackend* backend = config->render ? render_backend_create_null() : NULL;
+    if (step_ns == NULL || (config->collisions && grid == NULL) || (config->render && backend == NULL)) {
+        fprintf(stderr, "ERROR: out of memory for %zu entities\n", entity_count);
+        free(step_ns);
+        collision_grid_destroy(grid);
+        render_backend_destroy(backend);
+        return 0;
+    }
+
+    const EcsConfig ecs_config = {
+        .reserved_components    = ECS_DEFAULT_RESERVED_COMPONENTS,
+        .huge_pages             = config->huge_pages,
+    };
+
+    _rand_seed(config->seed);
+    EcsWorld* world = _create_world(&ecs_config, entity_count, bounds);
+    if (world == NULL) {
+        collision_grid_destroy(grid);
+        render_backend_destroy(backend);
+        free(step_ns);
+        return 0;
+    }
+
+    const float kernel_max_error = _verify_kernel(world, entity_count, bounds);
+
+    // rebuild from the same seed so the timed run doesn't depend on verification
+    ecs_world_destroy(world);
+    _rand_seed(config->seed);
+    world = _create_world(&ecs_config, entity_count, bounds);
+    if (world == NULL) {
+        collision_grid_destroy(grid);
+        render_backend_destroy(backend);
+        free(step_ns);
+        return 0;
+    }
+
+    render_snapshot_init();
+    uint64_t extract_ns = 0;
+    uint64_t submit_ns = 0;
+
+    CollisionStats collision_stats;
+    for (size_t i = 0; i < config->warmup_steps + config->steps; ++i) {
+        // counters only cover the timed steps
+        if (i == config->warmup_steps)
+            PERF_COUNTERS_RESET();
+
+        const uint64_t start = _now_ns();
+
+        if (grid != NULL)
+            system_collision(world, pool, grid, &collision_stats);
+        system_physics(world, pool, FIXED_DELTA_TIME, bounds);
+
+        const uint64_t end = _now_ns();
+        if (i >= config->warmup_steps)
+            step_ns[i - config->warmup_steps] = end - start;
+
+        // the same hand over the demo does, with the null backend standing in
+        // for raylib so only packing and submission are measured
+        if (backend != NULL) {
+            RenderSnapshot* snapshot = render_snapshot_begin_write();
+            const uint64_t extract_start = _now_ns();
+            system_extract_render_snapshot(world, snapshot);
+            const uint64_t extract_end = _now_ns();
+            render_snapshot_publish();
+
+            system_draw(backend, render_snapshot_acquire());
+            const uint64_t submit_end = _now_ns();
+
+            if (i >= config->warmup_steps) {
+                extract_ns += extract_end - extract_start;
+                submit_ns += submit_end - extract_end;
+            }
+        }
+    }
+
+    uint64_t total_ns = 0;
+    for (size_t i = 0; i < config->steps; ++i)
+        total_ns += step_ns[i];
+
+    qsort(step_ns, config->steps, sizeof(uint64_t), _compare_u64);
+    const size_t last = config->steps - 1;
+
+    EcsMemoryStats memory;
+    ecs_get_memory_stats(world, &memory);
+
+    *o_result = (BenchResult) {
+        .entity_count       = entity_count,
+        .steps              = config->steps,
+        .steps_per_sec      = config->steps / (total_ns / 1e9),
+        .ns_per_entity      = (double)total_ns / ((double)config->steps * entity_count),
+        .p50_us             = step_ns[last * 50 / 100] / 1e3,
+        .p90_us             = step_ns[last * 90 / 100] / 1e3,
+        .p99_us             = step_ns[last * 99 / 100] / 1e3,
+        .max_us             = step_ns[last] / 1e3,
+        .checksum           = _checksum(world),
+        .kernel_max_error   = kernel_max_error,
+        .extract_us         = extract_ns / 1e3 / config->steps,
+        .submit_us          = submit_ns / 1e3 / config->steps,
+        .bytes_per_entity   = (double)memory.committed_bytes / entity_count,
+    };
+
+#ifdef ECS_ENABLE_PERF_COUNTERS
+    // stderr, so the csv or json on stdout stays parseable
+    fprintf(stderr, "perf counters for %zu entities:\n", entity_count);
+#endif
+    PERF_COUNTERS_PRINT(stderr);
+
+    ecs_world_destroy(world);
+    collision_grid_destroy(grid);
+    render_backend_destroy(backend);
+    render_snapshot_free();
+    free(step_ns);
+    return 1;
+}
+
+static EcsWorld* _create_world(const EcsConfig* ecs_config, const size_t entity_count, const Vec2 bounds) {
+    EcsWorld* world = ecs_world_create(ecs_config);
+    if (world == NULL)
+        return NULL;
+
+    const ComponentMask mask = COMPONENT_POSITION | COMPONENT_DISPLAY | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER;
+    if (! ecs_spawn_batch(world, entity_count, mask, _init_world_batch, (void*)&bounds, NULL)) {
+        fprintf(stderr, "ERROR: failed to spawn %zu entities\n", entity_count);
+        ecs_world_destroy(world);
+        return NULL;
+    }
+
+    return world;
+}
+
+static void _init_world_batch(void* context, const EcsSpawnBatch* batch) {
+    const Vec2 bounds = *(const Vec2*)context;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        const float radius = 3.f + (_rand_u32() % 12);
+
+        batch->position.x[i] = _frand_range(radius, bounds.x - radius);
+        batch->position.y[i] = _frand_range(radius, bounds.y - radius);
+
+        batch->rigid_body.mass[i] = radius / 10.f;
+        batch->rigid_body.velocity_x[i] = _frand_range(-500.f, 500.f);
+        batch->rigid_body.velocity_y[i] = _frand_range(-50.f, 50.f);
+
+        batch->circle_collider.radius[i] = radius;
+
+        batch->display.radius[i] = radius;
+        batch->display.color[i] = (Color) { .r = _rand_u32() % 256, .g = _rand_u32() % 256, .b = _rand_u32() % 256, .a = 255 };
+    }
+}
+
+// steps copies of the body columns through the scalar reference and the
+// dispatched kernel, and returns the largest difference between the two
+static float _verify_kernel(EcsWorld* world, const size_t body_count, const Vec2 bounds) {
+    PositionColumns positions;
+    RigidBodyColumns rigid_bodies;
+    CircleColliderColumns colliders;
+    ecs_group(world, COMPONENT_POSITION | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER);
+    ecs_get_position_columns(world, &positions);
+    ecs_get_rigid_body_columns(world, &rigid_bodies);
+    ecs_get_circle_collider_columns(world, &colliders);
+
+    float* copies = malloc(sizeof(float)*body_count*8);
+    if (copies == NULL)
+        return NAN;
+
+    PhysicsBodies bodies[2];
+    for (size_t k = 0; k < 2; ++k) {
+        float* base = copies + (k * body_count * 4);
+        memcpy(base + (0 * body_count), positions.x, sizeof(float)*body_count);
+        memcpy(base + (1 * body_count), positions.y, sizeof(float)*body_count);
+        memcpy(base + (2 * body_count), rigid_bodies.velocity_x, sizeof(float)*body_count);
+        memcpy(base + (3 * body_count), rigid_bodies.velocity_y, sizeof(float)*body_count);
+
+        bodies[k] = (PhysicsBodies) {
+            .x          = base + (0 * body_count),
+            .y          = base + (1 * body_count),
+            .velocity_x = base + (2 * body_count),
+            .velocity_y = base + (3 * body_count),
+            .mass       = rigid_bodies.mass,
+            .radius     = colliders.radius,
+            .count      = body_count,
+        };
+    }
+
+    const PhysicsStepParams params = {
+        .delta_time         = FIXED_DELTA_TIME,
+        .gravity            = 2000.f,
+        .drag_coefficient   = 0.01f,
+        .bounds             = bounds,
+    };
+
+    for (size_t step = 0; step < VERIFY_STEPS; ++step) {
+        physics_integrate_scalar(&bodies[0], &params, 0, body_count);
+        physics_integrate(&bodies[1], &params, 0, body_count);
+    }
+
+    float max_error = 0.f;
+    for (size_t i = 0; i < body_count * 4; ++i)
+        max_error = fmaxf(max_error, fabsf(copies[i] - copies[i + (body_count * 4)]));
+
+    free(copies);
+    return max_error;
+}
+
+// checks every batched kernel the cpu can run against the scalar reference,
+// at counts that leave a remainder for both vector widths. returns 0 if any
+// of them drifts past VERIFY_TOLERANCE
+static int _verify_kernels(const BenchConfig* config) {
+    static const PhysicsKernel kernels[] = { PHYSICS_KERNEL_VEC4, PHYSICS_KERNEL_VEC8 };
+    static const char* kernel_names[] = { "vec4", "vec8" };
+    static const size_t counts[] = { 1, 3, 7, 13, 1000, 1003 };
+
+    const EcsConfig ecs_config = {
+        .reserved_components    = ECS_DEFAULT_RESERVED_COMPONENTS,
+        .huge_pages             = 0,
+    };
+
+    int ok = 1;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        if (! physics_kernel_select(kernels[k])) {
+            printf("%s: skipped, not supported on this cpu\n", kernel_names[k]);
+            continue;
+        }
+
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            const float world_size = REFERENCE_WORLD_SIZE * sqrtf(counts[c] / REFERENCE_ENTITY_COUNT);
+            const Vec2 bounds = { .x = world_size, .y = world_size };
+
+            _rand_seed(config->seed);
+            EcsWorld* world = _create_world(&ecs_config, counts[c], bounds);
+            if (world == NULL)
+                return 0;
+
+            const float max_error = _verify_kernel(world, counts[c], bounds);
+            ecs_world_destroy(world);
+
+            // written so a NaN fails too
+            const int passed = max_error <= VERIFY_TOLERANCE;
+            printf("%s: %zu bodies, max error %g, %s\n", physics_kernel_name(), counts[c], max_error, passed ? "ok" : "FAILED");
+            ok = ok && passed;
+        }
+    }
+
+    physics_kernel_select(PHYSICS_KERNEL_AUTO);
+    return ok;
+}
+
+// checks that changed queries skip chunks nobody wrote to but still report
+// components moved by swap and pop or grouping, and that the recorder, which
+// only captures what they report, still replays the world exactly. returns 0
+// if any check fails
+static int _verify_changes(const BenchConfig* config) {
+    const EcsConfig ecs_config = {
+        .reserved_components    = ECS_DEFAULT_RESERVED_COMPONENTS,
+        .huge_pages             = 0,
+    };
+    const Vec2 bounds = { .x = REFERENCE_WORLD_SIZE, .y = REFERENCE_WORLD_SIZE };
+
+    _rand_seed(config->seed);
+    EcsWorld* world = _create_world(&ecs_config, VERIFY_CHANGES_ENTITIES, bounds);
+    if (world == NULL)
+        return 0;
+
+    Recorder* recorder = recorder_create(VERIFY_CHANGES_PATH, NULL);
+    if (recorder == NULL) {
+        ecs_world_destroy(world);
+        return 0;
+    }
+
+    int ok = 1;
+    uint64_t step = 0;
+    RecorderStats before;
+    RecorderStats after;
+
+    // the first capture has every component, and the next has none
+    ok &= recorder_capture(recorder, world, ++step);
+    recorder_get_stats(recorder, &before);
+    ok &= recorder_capture(recorder, world, ++step);
+    recorder_get_stats(recorder, &after);
+    ok &= _report("first capture copies every component", before.components_captured == 3 * VERIFY_CHANGES_ENTITIES);
+    ok &= _report("unchanged chunks aren't captured", after.components_captured == before.components_captured);
+
+    // a single write only brings in its own chunk
+    EcsVersion since = ecs_change_tick(world);
+    PositionColumns positions;
+    ecs_get_position_columns(world, &positions);
+    const EntityID written = positions.owners[positions.count / 2];
+    const PositionComponent position = { .pos = { .x = 1.f, .y = 2.f } };
+    ecs_set_position_component(world, written, &position);
+
+    int found = 0;
+    const size_t changed = _count_changed(world, COMPONENT_TYPE_POSITION, since, written, &found);
+    ok &= _report("a written component is reported", found);
+    ok &= _report("chunks around a write are skipped", changed <= ECS_CHANGE_CHUNK_SIZE);
+
+    before = after;
+    ok &= recorder_capture(recorder, world, ++step);
+    recorder_get_stats(recorder, &after);
+    ok &= _report("only the written chunk is captured", after.components_captured - before.components_captured <= ECS_CHANGE_CHUNK_SIZE);
+
+    // removing the first display moves the last one into its slot
+    since = ecs_change_tick(world);
+    DisplayColumns displays;
+    ecs_get_display_columns(world, &displays);
+    const EntityID moved = displays.owners[displays.count - 1];
+    ecs_remove_display_component(world, displays.owners[0]);
+    _count_changed(world, COMPONENT_TYPE_DISPLAY, since, moved, &found);
+    ok &= _report("swap and pop moves are reported", found);
+    ok &= recorder_capture(recorder, world, ++step);
+
+    // a body without a position has to be grouped out of the way, moving
+    // every body past it
+    ecs_get_position_columns(world, &positions);
+    ecs_remove_position_component(world, positions.owners[0]);
+
+    RigidBodyColumns bodies;
+    ecs_get_rigid_body_columns(world, &bodies);
+    EntityID* old_owners = malloc(sizeof(EntityID)*bodies.count);
+    if (old_owners == NULL) {
+        recorder_destroy(recorder);
+        ecs_world_destroy(world);
+        return 0;
+    }
+
+    memcpy(old_owners, bodies.owners, sizeof(EntityID)*bodies.count);
+    since = ecs_change_tick(world);
+    ecs_group(world, COMPONENT_POSITION | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER);
+
+    ecs_get_rigid_body_columns(world, &bodies);
+    size_t group_moves = 0;
+    size_t group_moves_reported = 0;
+    for (size_t i = 0; i < bodies.count; ++i) {
+        if (bodies.owners[i] == old_owners[i])
+            continue;
+
+        group_moves++;
+        _count_changed(world, COMPONENT_TYPE_RIGID_BODY, since, bodies.owners[i], &found);
+        group_moves_reported += found;
+    }
+
+    free(old_owners);
+    ok &= _report("group moves are reported", group_moves > 0 && group_moves_reported == group_moves);
+    ok &= recorder_capture(recorder, world, ++step);
+
+    for (size_t i = 0; i < VERIFY_CHANGES_STEPS; ++i) {
+        system_physics(world, NULL, FIXED_DELTA_TIME, bounds);
+        ok &= recorder_capture(recorder, world, ++step);
+    }
+
+    ecs_get_position_columns(world, &positions);
+    ecs_destroy_entity(world, positions.owners[positions.count / 3]);
+    ok &= recorder_capture(recorder, world, ++step);
+
+    recorder_destroy(recorder);
+    ok &= _report("replay matches the world", _verify_replay(world, step));
+
+    remove(VERIFY_CHANGES_PATH);
+    ecs_world_destroy(world);
+    return ok;
+}
+
+// how many components of a pool a changed query reports, and whether entity's
+// is one of them
+static size_t _count_changed(const EcsWorld* world, const ComponentType type, const EcsVersion since, const EntityID entity, int* o_found) {
+    size_t count = 0;
+    *o_found = 0;
+
+    EcsQuery query = ecs_query_changed(world, COMPONENT_MASK(type), COMPONENT_MASK(type), since);
+    while (ecs_query_next(&query)) {
+        count++;
+        *o_found |= query.entity == entity;
+    }
+
+    return count;
+}
+
+// the last of frame_count frames has to hold every entity with a position,
+// within half a quantum, and nothing else
+static int _verify_replay(EcsWorld* world, const size_t frame_count) {
+    Replay* replay = replay_open(VERIFY_CHANGES_PATH);
+    if (replay == NULL)
+        return 0;
+
+    ReplayFrame frame;
+    size_t frames = 0;
+    while (replay_next(replay, &frame))
+        frames++;
+
+    PositionColumns positions;
+    ecs_get_position_columns(world, &positions);
+    int ok = frames == frame_count && frame.count == positions.count;
+
+    const float tolerance = DEFAULT_RECORDER_QUANTUM * 0.5f;
+    for (size_t i = 0; i < frame.count && ok; ++i) {
+        PositionComponent position;
+        ok = ecs_get_position_component(world, frame.ids[i], &position)
+            && fabsf(frame.x[i] - position.pos.x) <= tolerance
+            && fabsf(frame.y[i] - position.pos.y) <= tolerance
+            && frame.has_display[i] == ecs_has_component(world, frame.ids[i], COMPONENT_TYPE_DISPLAY);
+    }
+
+    replay_close(replay);
+    return ok;
+}
+
+static int _report(const char* check, const int passed) {
+    printf("%s: %s\n", check, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+// a cheap fingerprint of the final state, for spotting behaviour changes
+// between commits alongside the timings
+static double _checksum(EcsWorld* world) {
+    PositionColumns positions;
+    ecs_get_position_columns(world, &positions);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < positions.count; ++i)
+        sum += positions.x[i] + positions.y[i];
+
+    return sum;
+}
+
+static void _print_result(const BenchConfig* config, const BenchResult* result, const size_t index) {
+    if (config->format == OUTPUT_CSV) {
+        printf("%zu,%zu,%.2f,%.3f,%.2f,%.2f,%.2f,%.2f,%.6e,%s,%g,%zu,%d,%.2f,%.2f,%.1f\n",
+            result->entity_count, result->steps, result->steps_per_sec, result->ns_per_entity,
+            result->p50_us, result->p90_us, result->p99_us, result->max_us, result->checksum,
+            physics_kernel_name(), result->kernel_max_error, config->worker_count, config->collisions,
+            result->extract_us, result->submit_us, result->bytes_per_entity);
+    } else {
+        printf("%s  {\"entities\":%zu,\"steps\":%zu,\"steps_per_sec\":%.2f,\"ns_per_entity\":%.3f,"
+            "\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,\"checksum\":%.6e,"
+            "\"kernel_max_error\":%g,\"extract_us\":%.2f,\"submit_us\":%.2f,\"bytes_per_entity\":%.1f}",
+            index > 0 ? ",\n" : "",
+            result->entity_count, result->steps, result->steps_per_sec, result->ns_per_entity,
+            result->p50_us, result->p90_us, result->p99_us, result->max_us, result->checksum,
+            result->kernel_max_error, result->extract_us, result->submit_us, result->bytes_per_entity);
+    }
+
+    fflush(stdout);
+}
+
+static int _compare_u64(const void* a, const void* b) {
+    const uint64_t lhs = *(const uint64_t*)a;
+    const uint64_t rhs = *(const uint64_t*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, so runs are identical across platforms and libc versions
+static void _rand_seed(uint64_t seed) {
+    s_rng_state = seed != 0 ? seed : DEFAULT_SEED;
+}
+
+static uint32_t _rand_u32(void) {
+    s_rng_state ^= s_rng_state >> 12;
+    s_rng_state ^= s_rng_state << 25;
+    s_rng_state ^= s_rng_state >> 27;
+    return (uint32_t)((s_rng_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static float _frand_range(float min, float max) {
+    const float unit = _rand_u32() / 4294967296.f;
+    return min + (max - min) * unit;
+}
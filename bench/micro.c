@@ -0,0 +1,475 @@
+// microbenchmarks for the ecs core. every case runs against pools of each
+// requested size: a few untimed warmup repetitions, then timed ones, reported
+// as the median and p99 cost per operation in nanoseconds and, where the cpu
+// has a timestamp counter, cycles. results are written as json so runs from
+// different commits can be diffed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLE_COUNTER 1
+#else
+#define HAS_CYCLE_COUNTER 0
+#endif
+
+#include "ecs.h"
+#include "systems.h"
+#include "vec_maths.h"
+#include "physics_kernel.h"
+
+#define DEFAULT_SEED 0x5eedu
+#define DEFAULT_WARMUP_REPS 3
+#define DEFAULT_REPS 15
+#define MAX_SIZES 16
+#define FIXED_DELTA_TIME (1.f / 60.f)
+
+#define ALL_COMPONENTS (COMPONENT_POSITION | COMPONENT_DISPLAY | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER)
+
+typedef struct {
+    size_t          sizes[MAX_SIZES];
+    size_t          size_count;
+    size_t          warmup_reps;
+    size_t          reps;
+    uint64_t        seed;
+    const char*     filter;
+} MicroConfig;
+
+// everything a case might need. the shared world is built once per size,
+// cases that create entities build their own before every repetition
+typedef struct {
+    size_t      size;
+    EcsWorld*   world;
+    EntityID*   ids;            // live, shuffled
+    EntityID*   stale_ids;      // the same entities a generation on
+    Vec2*       vectors;
+    Vec2*       velocities;
+    EcsWorld*   scratch_world;
+    Vec2        bounds;
+} MicroState;
+
+typedef struct {
+    const char* name;
+
+    // untimed, before every repetition. returns 0 on failure
+    int         (*prepare)(MicroState* state);
+
+    // timed. returns how many operations it did
+    size_t      (*run)(MicroState* state);
+} MicroCase;
+
+typedef struct {
+    uint64_t    ns;
+    uint64_t    cycles;
+} MicroSample;
+
+static volatile double s_sink;
+static uint64_t s_rng_state;
+
+static int _parse_args(int argc, char** argv, MicroConfig* o_config);
+static int _setup_state(MicroState* state, const size_t size);
+static void _teardown_state(MicroState* state);
+static int _run_case(const MicroConfig* config, const MicroCase* micro_case, MicroState* state, int* io_first);
+static void _init_batch(void* context, const EcsSpawnBatch* batch);
+
+static int _prepare_scratch_world(MicroState* state);
+static size_t _run_spawn_entity(MicroState* state);
+static size_t _run_spawn_batch(MicroState* state);
+static size_t _run_lookup_hit(MicroState* state);
+static size_t _run_lookup_miss(MicroState* state);
+static size_t _run_iterate_position(MicroState* state);
+static size_t _run_iterate_display(MicroState* state);
+static size_t _run_iterate_rigid_body(MicroState* state);
+static size_t _run_iterate_circle_collider(MicroState* state);
+static size_t _run_query(MicroState* state);
+static size_t _run_physics_step(MicroState* state);
+static size_t _run_vec_maths(MicroState* state);
+
+static int _compare_samples(const void* a, const void* b);
+static uint64_t _now_ns(void);
+static uint64_t _now_cycles(void);
+static void _rand_seed(uint64_t seed);
+static uint32_t _rand_u32(void);
+static float _frand_range(float min, float max);
+
+static const MicroCase s_cases[] = {
+    { "spawn_entity",               _prepare_scratch_world, _run_spawn_entity },
+    { "spawn_batch",                _prepare_scratch_world, _run_spawn_batch },
+    { "lookup_hit",                 NULL,                   _run_lookup_hit },
+    { "lookup_miss",                NULL,                   _run_lookup_miss },
+    { "iterate_position",           NULL,                   _run_iterate_position },
+    { "iterate_display",            NULL,                   _run_iterate_display },
+    { "iterate_rigid_body",         NULL,                   _run_iterate_rigid_body },
+    { "iterate_circle_collider",    NULL,                   _run_iterate_circle_collider },
+    { "query_position_display",     NULL,                   _run_query },
+    { "physics_step",               NULL,                   _run_physics_step },
+    { "vec_maths",                  NULL,                   _run_vec_maths },
+};
+
+int main(int argc, char** argv) {
+    MicroConfig config;
+    if (! _parse_args(argc, argv, &config))
+        return 1;
+
+    printf("{\"timer\":\"%s\",\"kernel\":\"%s\",\"warmup_reps\":%zu,\"reps\":%zu,\"seed\":%llu,\"results\":[\n",
+        HAS_CYCLE_COUNTER ? "clock_gettime+rdtsc" : "clock_gettime", physics_kernel_name(),
+        config.warmup_reps, config.reps, (unsigned long long)config.seed);
+
+    int ok = 1;
+    int first = 1;
+    for (size_t i = 0; i < config.size_count && ok; ++i) {
+        MicroState state;
+        _rand_seed(config.seed);
+        ok = _setup_state(&state, config.sizes[i]);
+
+        for (size_t c = 0; c < sizeof(s_cases) / sizeof(s_cases[0]) && ok; ++c) {
+            if (config.filter == NULL || strstr(s_cases[c].name, config.filter) != NULL)
+                ok = _run_case(&config, &s_cases[c], &state, &first);
+        }
+
+        _teardown_state(&state);
+    }
+
+    printf("\n]}\n");
+    return ok ? 0 : 1;
+}
+
+static int _parse_args(int argc, char** argv, MicroConfig* o_config) {
+    *o_config = (MicroConfig) {
+        .sizes          = { 1000, 10000, 100000, 1000000 },
+        .size_count     = 4,
+        .warmup_reps    = DEFAULT_WARMUP_REPS,
+        .reps           = DEFAULT_REPS,
+        .seed           = DEFAULT_SEED,
+        .filter         = NULL,
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--reps") == 0 && value != NULL) {
+            o_config->reps = strtoull(value, NULL, 10);
+            ++i;
+        } else if (strcmp(arg, "--warmup") == 0 && value != NULL) {
+            o_config->warmup_reps = strtoull(value, NULL, 10);
+            ++i;
+        } else if (strcmp(arg, "--seed") == 0 && value != NULL) {
+            o_config->seed = strtoull(value, NULL, 0);
+            ++i;
+        } else if (strcmp(arg, "--filter") == 0 && value != NULL) {
+            o_config->filter = value;
+            ++i;
+        } else if (strcmp(arg, "--sizes") == 0 && value != NULL) {
+            // comma separated list, e.g. --sizes 1000,50000
+            o_config->size_count = 0;
+            const char* cursor = value;
+            while (*cursor != '\0' && o_config->size_count < MAX_SIZES) {
+                char* end = NULL;
+                o_config->sizes[o_config->size_count++] = strtoull(cursor, &end, 10);
+                cursor = *end == ',' ? end + 1 : end;
+            }
+            ++i;
+        } else {
+            fprintf(stderr, "usage: %s [--sizes N,N,...] [--reps N] [--warmup N] [--seed N] [--filter NAME]\n", argv[0]);
+            return 0;
+        }
+    }
+
+    if (o_config->reps == 0 || o_config->size_count == 0) {
+        fprintf(stderr, "ERROR: need at least one repetition and one size\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < o_config->size_count; ++i) {
+        if (o_config->sizes[i] == 0) {
+            fprintf(stderr, "ERROR: sizes have to be at least 1\n");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int _setup_state(MicroState* state, const size_t size) {
+    memset(state, 0, sizeof(*state));
+    state->size = size;
+    state->bounds = (Vec2) { .x = 512.f, .y = 512.f };
+
+    state->world = ecs_world_create(NULL);
+    state->ids = malloc(sizeof(EntityID)*size);
+    state->stale_ids = malloc(sizeof(EntityID)*size);
+    state->vectors = malloc(sizeof(Vec2)*size);
+    state->velocities = malloc(sizeof(Vec2)*size);
+    if (state->world == NULL || state->ids == NULL || state->stale_ids == NULL
+        || state->vectors == NULL || state->velocities == NULL
+        || ! ecs_spawn_batch(state->world, size, ALL_COMPONENTS, _init_batch, state, state->ids)) {
+        fprintf(stderr, "ERROR: out of memory for %zu entities\n", size);
+        return 0;
+    }
+
+    // lookups visit entities in random order, as gameplay code would
+    for (size_t i = size - 1; i > 0; --i) {
+        const size_t j = _rand_u32() % (i + 1);
+        const EntityID tmp = state->ids[i];
+        state->ids[i] = state->ids[j];
+        state->ids[j] = tmp;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        state->stale_ids[i] = state->ids[i] + ((EntityID)1 << ECS_ENTITY_INDEX_BITS);
+        state->vectors[i] = (Vec2) { .x = _frand_range(0.f, 512.f), .y = _frand_range(0.f, 512.f) };
+        state->velocities[i] = (Vec2) { .x = _frand_range(-500.f, 500.f), .y = _frand_range(-50.f, 50.f) };
+    }
+
+    return 1;
+}
+
+static void _teardown_state(MicroState* state) {
+    ecs_world_destroy(state->world);
+    ecs_world_destroy(state->scratch_world);
+    free(state->ids);
+    free(state->stale_ids);
+    free(state->vectors);
+    free(state->velocities);
+}
+
+static int _run_case(const MicroConfig* config, const MicroCase* micro_case, MicroState* state, int* io_first) {
+    MicroSample* samples = malloc(sizeof(MicroSample)*config->reps);
+    if (samples == NULL) {
+        fprintf(stderr, "ERROR: out of memory for %zu repetitions\n", config->reps);
+        return 0;
+    }
+
+    size_t ops = 0;
+    for (size_t rep = 0; rep < config->warmup_reps + config->reps; ++rep) {
+        if (micro_case->prepare != NULL && ! micro_case->prepare(state)) {
+            free(samples);
+            return 0;
+        }
+
+        const uint64_t start_cycles = _now_cycles();
+        const uint64_t start_ns = _now_ns();
+        ops = micro_case->run(state);
+        const uint64_t end_ns = _now_ns();
+        const uint64_t end_cycles = _now_cycles();
+
+        if (rep >= config->warmup_reps) {
+            samples[rep - config->warmup_reps] = (MicroSample) {
+                .ns     = end_ns - start_ns,
+                .cycles = end_cycles - start_cycles,
+            };
+        }
+    }
+
+    // ns and cycles are sorted together, so the median cycles belong to the
+    // median run rather than being picked independently
+    qsort(samples, config->reps, sizeof(MicroSample), _compare_samples);
+    const size_t last = config->reps - 1;
+    const MicroSample median = samples[last / 2];
+    const MicroSample p99 = samples[last * 99 / 100];
+    const double per_op = ops > 0 ? 1.0 / ops : 0.0;
+
+    printf("%s  {\"name\":\"%s\",\"size\":%zu,\"ops\":%zu,\"median_ns_per_op\":%.3f,\"p99_ns_per_op\":%.3f,"
+        "\"median_cycles_per_op\":%.2f,\"p99_cycles_per_op\":%.2f}",
+        *io_first ? "" : ",\n", micro_case->name, state->size, ops,
+        median.ns * per_op, p99.ns * per_op, median.cycles * per_op, p99.cycles * per_op);
+    fflush(stdout);
+
+    *io_first = 0;
+    free(samples);
+    return 1;
+}
+
+static void _init_batch(void* context, const EcsSpawnBatch* batch) {
+    const MicroState* state = context;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        const float radius = 3.f + (_rand_u32() % 12);
+
+        batch->position.x[i] = _frand_range(radius, state->bounds.x - radius);
+        batch->position.y[i] = _frand_range(radius, state->bounds.y - radius);
+
+        batch->rigid_body.mass[i] = radius / 10.f;
+        batch->rigid_body.velocity_x[i] = _frand_range(-500.f, 500.f);
+        batch->rigid_body.velocity_y[i] = _frand_range(-50.f, 50.f);
+
+        batch->circle_collider.radius[i] = radius;
+
+        batch->display.radius[i] = radius;
+        batch->display.color[i] = (Color) { .r = _rand_u32() % 256, .g = _rand_u32() % 256, .b = _rand_u32() % 256, .a = 255 };
+    }
+}
+
+static int _prepare_scratch_world(MicroState* state) {
+    ecs_world_destroy(state->scratch_world);
+    state->scratch_world = ecs_world_create(NULL);
+    return state->scratch_world != NULL;
+}
+
+static size_t _run_spawn_entity(MicroState* state) {
+    EcsWorld* world = state->scratch_world;
+
+    const PositionComponent position = { .pos = { .x = 1.f, .y = 2.f } };
+    const DisplayComponent display = { .radius = 3.f, .color = { 255, 0, 0, 255 } };
+    const RigidBodyComponent rigid_body = { .mass = 0.3f, .velocity = { .x = 4.f, .y = 5.f } };
+    const CircleColliderComponent collider = { .radius = 3.f };
+
+    for (size_t i = 0; i < state->size; ++i) {
+        const EntityID entity_id = ecs_new_entity(world);
+        ecs_new_position_component(world, entity_id, &position);
+        ecs_new_display_component(world, entity_id, &display);
+        ecs_new_rigid_body_component(world, entity_id, &rigid_body);
+        ecs_new_circle_collider_component(world, entity_id, &collider);
+    }
+
+    return state->size;
+}
+
+static size_t _run_spawn_batch(MicroState* state) {
+    ecs_spawn_batch(state->scratch_world, state->size, ALL_COMPONENTS, _init_batch, state, NULL);
+    return state->size;
+}
+
+static size_t _run_lookup_hit(MicroState* state) {
+    double sum = 0.0;
+    for (size_t i = 0; i < state->size; ++i) {
+        PositionComponent position;
+        if (ecs_get_position_component(state->world, state->ids[i], &position))
+            sum += position.pos.x;
+    }
+
+    s_sink = sum;
+    return state->size;
+}
+
+static size_t _run_lookup_miss(MicroState* state) {
+    size_t found = 0;
+    for (size_t i = 0; i < state->size; ++i) {
+        PositionComponent position;
+        found += ecs_get_position_component(state->world, state->stale_ids[i], &position);
+    }
+
+    s_sink = found;
+    return state->size;
+}
+
+static size_t _run_iterate_position(MicroState* state) {
+    PositionColumns columns;
+    ecs_get_position_columns(state->world, &columns);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < columns.count; ++i)
+        sum += columns.x[i] + columns.y[i];
+
+    s_sink = sum;
+    return columns.count;
+}
+
+static size_t _run_iterate_display(MicroState* state) {
+    DisplayColumns columns;
+    ecs_get_display_columns(state->world, &columns);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < columns.count; ++i)
+        sum += columns.radius[i] + columns.color[i].r;
+
+    s_sink = sum;
+    return columns.count;
+}
+
+static size_t _run_iterate_rigid_body(MicroState* state) {
+    RigidBodyColumns columns;
+    ecs_get_rigid_body_columns(state->world, &columns);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < columns.count; ++i)
+        sum += columns.mass[i] + columns.velocity_x[i] + columns.velocity_y[i];
+
+    s_sink = sum;
+    return columns.count;
+}
+
+static size_t _run_iterate_circle_collider(MicroState* state) {
+    CircleColliderColumns columns;
+    ecs_get_circle_collider_columns(state->world, &columns);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < columns.count; ++i)
+        sum += columns.radius[i];
+
+    s_sink = sum;
+    return columns.count;
+}
+
+static size_t _run_query(MicroState* state) {
+    PositionColumns positions;
+    DisplayColumns displays;
+    ecs_get_position_columns(state->world, &positions);
+    ecs_get_display_columns(state->world, &displays);
+
+    double sum = 0.0;
+    size_t count = 0;
+    EcsQuery query = ecs_query(state->world, COMPONENT_POSITION | COMPONENT_DISPLAY);
+    while (ecs_query_next(&query)) {
+        sum += positions.x[query.index[COMPONENT_TYPE_POSITION]] + displays.radius[query.index[COMPONENT_TYPE_DISPLAY]];
+        count++;
+    }
+
+    s_sink = sum;
+    return count;
+}
+
+static size_t _run_physics_step(MicroState* state) {
+    system_physics(state->world, NULL, FIXED_DELTA_TIME, state->bounds);
+    return state->size;
+}
+
+static size_t _run_vec_maths(MicroState* state) {
+    for (size_t i = 0; i < state->size; ++i)
+        state->vectors[i] = vec2_add(state->vectors[i], vec2_mul(state->velocities[i], FIXED_DELTA_TIME));
+
+    s_sink = state->vectors[state->size / 2].x;
+    return state->size;
+}
+
+static int _compare_samples(const void* a, const void* b) {
+    const uint64_t lhs = ((const MicroSample*)a)->ns;
+    const uint64_t rhs = ((const MicroSample*)b)->ns;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+// reference cycles, which tick at a constant rate on anything recent
+static uint64_t _now_cycles(void) {
+#if HAS_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// xorshift64*, so runs are identical across platforms and libc versions
+static void _rand_seed(uint64_t seed) {
+    s_rng_state = seed != 0 ? seed : DEFAULT_SEED;
+}
+
+static uint32_t _rand_u32(void) {
+    s_rng_state ^= s_rng_state >> 12;
+    s_rng_state ^= s_rng_state << 25;
+    s_rng_state ^= s_rng_state >> 27;
+    return (uint32_t)((s_rng_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static float _frand_range(float min, float max) {
+    const float unit = _rand_u32() / 4294967296.f;
+    return min + (max - min) * unit;
+}
@@ -0,0 +1,358 @@
+#include "collision.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define RESTITUTION 0.8f
+
+// fraction of the overlap pushed out per step, and how much overlap is left
+// alone, so resting contacts don't jitter
+#define CORRECTION_PERCENT 0.8f
+#define CORRECTION_SLOP 0.01f
+
+// cells are made wider than they need to be rather than let the grid grow
+// past this many per body. a body flung far from the rest coarsens the grid
+// for everyone, but the physics system keeps them all within its bounds.
+#define MAX_CELLS_PER_BODY 4
+#define MIN_CELL_COUNT 4096
+
+#define GATHER_CHUNK_SIZE 4096
+#define ROW_CHUNK_SIZE 2
+
+struct CollisionGrid {
+    uint32_t*   cell_of;        // per body
+    uint32_t*   sorted;         // body indices ordered by cell
+    size_t      body_capacity;
+
+    // bodies copied out in sorted order, so a cell and its neighbours sit
+    // next to each other in memory while they're tested
+    float*      x;
+    float*      y;
+    float*      velocity_x;
+    float*      velocity_y;
+    float*      mass;
+    float*      radius;
+
+    uint32_t*   cell_start;     // cell c owns sorted[cell_start[c], cell_start[c+1]), plus one spare slot
+    size_t      cell_capacity;
+    size_t      width;
+    size_t      height;
+};
+
+typedef struct {
+    CollisionGrid*          grid;
+    const PhysicsBodies*    bodies;     // in their own order
+    PhysicsBodies           gathered;   // in cell order
+    size_t                  phase;
+    atomic_size_t           candidate_pairs;
+    atomic_size_t           contacts;
+} CollisionJob;
+
+static int _reserve(CollisionGrid* grid, const size_t body_count, const size_t cell_count);
+static void _gather_job(void* context, size_t begin, size_t end);
+static void _scatter_job(void* context, size_t begin, size_t end);
+static void _row_job(void* context, size_t begin, size_t end);
+static int _resolve_pair(const PhysicsBodies* bodies, uint32_t a, uint32_t b);
+static uint64_t _now_ns(void);
+
+CollisionGrid* collision_grid_create(void) {
+    return calloc(1, sizeof(CollisionGrid));
+}
+
+void collision_grid_destroy(CollisionGrid* grid) {
+    if (grid == NULL)
+        return;
+
+    free(grid->cell_of);
+    free(grid->sorted);
+    free(grid->x);
+    free(grid->y);
+    free(grid->velocity_x);
+    free(grid->velocity_y);
+    free(grid->mass);
+    free(grid->radius);
+    free(grid->cell_start);
+    free(grid);
+}
+
+void collision_resolve(CollisionGrid* grid, ThreadPool* pool, const PhysicsBodies* bodies, CollisionStats* o_stats) {
+    CollisionStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.body_count = bodies->count;
+
+    if (bodies->count < 2 || bodies->count > UINT32_MAX / MAX_CELLS_PER_BODY) {
+        *o_stats = stats;
+        return;
+    }
+
+    const uint64_t broadphase_start = _now_ns();
+
+    // any two overlapping circles are at most two of the largest radii apart,
+    // so with cells that wide they always land in neighbouring cells
+    float max_radius = 0.f;
+    float min_x = bodies->x[0];
+    float max_x = bodies->x[0];
+    float min_y = bodies->y[0];
+    float max_y = bodies->y[0];
+    for (size_t i = 0; i < bodies->count; ++i) {
+        max_radius = fmaxf(max_radius, bodies->radius[i]);
+        min_x = fminf(min_x, bodies->x[i]);
+        max_x = fmaxf(max_x, bodies->x[i]);
+        min_y = fminf(min_y, bodies->y[i]);
+        max_y = fmaxf(max_y, bodies->y[i]);
+    }
+
+    const size_t max_cells = bodies->count * MAX_CELLS_PER_BODY > MIN_CELL_COUNT
+        ? bodies->count * MAX_CELLS_PER_BODY
+        : MIN_CELL_COUNT;
+
+    float cell_size = fmaxf(max_radius * 2.f, 1.f);
+    double width = floor((max_x - min_x) / cell_size) + 1.0;
+    double height = floor((max_y - min_y) / cell_size) + 1.0;
+    while (width * height > (double)max_cells) {
+        cell_size *= 2.f;
+        width = floor((max_x - min_x) / cell_size) + 1.0;
+        height = floor((max_y - min_y) / cell_size) + 1.0;
+    }
+
+    stats.cell_size = cell_size;
+
+    if (! _reserve(grid, bodies->count, (size_t)width * (size_t)height)) {
+        *o_stats = stats;
+        return;
+    }
+
+    grid->width = (size_t)width;
+    grid->height = (size_t)height;
+    const size_t cell_count = grid->width * grid->height;
+    const float inv_cell_size = 1.f / cell_size;
+
+    // counting sort of body indices by cell. counts are kept two slots up so
+    // that after the prefix sum slot c+1 holds where cell c starts, and
+    // filling it in bumps that to where cell c ends, which is where c+1
+    // starts. that leaves cell c at [cell_start[c], cell_start[c+1]).
+    // clamping only guards against rounding at the far edges, and can't
+    // pull two neighbouring cells further apart.
+    memset(grid->cell_start, 0, sizeof(uint32_t)*(cell_count + 2));
+    for (size_t i = 0; i < bodies->count; ++i) {
+        const size_t cx = (size_t)fminf((bodies->x[i] - min_x) * inv_cell_size, (float)(grid->width - 1));
+        const size_t cy = (size_t)fminf((bodies->y[i] - min_y) * inv_cell_size, (float)(grid->height - 1));
+        grid->cell_of[i] = (uint32_t)((cy * grid->width) + cx);
+        grid->cell_start[grid->cell_of[i] + 2]++;
+    }
+
+    for (size_t c = 2; c < cell_count + 2; ++c)
+        grid->cell_start[c] += grid->cell_start[c - 1];
+
+    for (size_t i = 0; i < bodies->count; ++i)
+        grid->sorted[grid->cell_start[grid->cell_of[i] + 1]++] = (uint32_t)i;
+
+    CollisionJob job = {
+        .grid       = grid,
+        .bodies     = bodies,
+        .gathered   = {
+            .x          = grid->x,
+            .y          = grid->y,
+            .velocity_x = grid->velocity_x,
+            .velocity_y = grid->velocity_y,
+            .mass       = grid->mass,
+            .radius     = grid->radius,
+            .count      = bodies->count,
+        },
+    };
+    atomic_init(&job.candidate_pairs, 0);
+    atomic_init(&job.contacts, 0);
+
+    thread_pool_parallel_for(pool, _gather_job, &job, bodies->count, GATHER_CHUNK_SIZE);
+
+    const uint64_t narrowphase_start = _now_ns();
+    stats.broadphase_ns = narrowphase_start - broadphase_start;
+
+    // a row only touches itself and the row below, so every other row can be
+    // walked at once without two workers landing on the same body. the even
+    // rows all go first and the odd ones after, however many workers there
+    // are, which keeps the result the same from run to run.
+    for (size_t phase = 0; phase < 2; ++phase) {
+        job.phase = phase;
+        const size_t rows = (grid->height + 1 - phase) / 2;
+        thread_pool_parallel_for(pool, _row_job, &job, rows, ROW_CHUNK_SIZE);
+    }
+
+    thread_pool_parallel_for(pool, _scatter_job, &job, bodies->count, GATHER_CHUNK_SIZE);
+
+    stats.candidate_pairs = atomic_load(&job.candidate_pairs);
+    stats.contacts = atomic_load(&job.contacts);
+    stats.narrowphase_ns = _now_ns() - narrowphase_start;
+    *o_stats = stats;
+}
+
+static int _reserve(CollisionGrid* grid, const size_t body_count, const size_t cell_count) {
+    if (body_count > grid->body_capacity) {
+        size_t capacity = grid->body_capacity > 0 ? grid->body_capacity : 1024;
+        while (capacity < body_count)
+            capacity *= 2;
+
+        uint32_t* cell_of   = realloc(grid->cell_of, sizeof(uint32_t)*capacity);
+        if (cell_of != NULL) grid->cell_of = cell_of;
+        uint32_t* sorted    = realloc(grid->sorted, sizeof(uint32_t)*capacity);
+        if (sorted != NULL) grid->sorted = sorted;
+
+        float** columns[] = { &grid->x, &grid->y, &grid->velocity_x, &grid->velocity_y, &grid->mass, &grid->radius };
+        int columns_ok = 1;
+        for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); ++i) {
+            float* column = realloc(*columns[i], sizeof(float)*capacity);
+            if (column != NULL)
+                *columns[i] = column;
+            else
+                columns_ok = 0;
+        }
+
+        if (cell_of == NULL || sorted == NULL || ! columns_ok)
+            return 0;
+
+        grid->body_capacity = capacity;
+    }
+
+    if (cell_count > grid->cell_capacity) {
+        size_t capacity = grid->cell_capacity > 0 ? grid->cell_capacity : MIN_CELL_COUNT;
+        while (capacity < cell_count)
+            capacity *= 2;
+
+        uint32_t* cell_start = realloc(grid->cell_start, sizeof(uint32_t)*(capacity + 2));
+        if (cell_start == NULL)
+            return 0;
+
+        grid->cell_start = cell_start;
+        grid->cell_capacity = capacity;
+    }
+
+    return 1;
+}
+
+static void _gather_job(void* context, size_t begin, size_t end) {
+    CollisionJob* job = context;
+    const PhysicsBodies* bodies = job->bodies;
+    CollisionGrid* grid = job->grid;
+    const uint32_t* sorted = grid->sorted;
+
+    for (size_t s = begin; s < end; ++s) {
+        const uint32_t i = sorted[s];
+        grid->x[s]          = bodies->x[i];
+        grid->y[s]          = bodies->y[i];
+        grid->velocity_x[s] = bodies->velocity_x[i];
+        grid->velocity_y[s] = bodies->velocity_y[i];
+        grid->mass[s]       = bodies->mass[i];
+        grid->radius[s]     = bodies->radius[i];
+    }
+}
+
+// mass and radius are left alone by contacts, so only these come back
+static void _scatter_job(void* context, size_t begin, size_t end) {
+    CollisionJob* job = context;
+    const PhysicsBodies* bodies = job->bodies;
+    const CollisionGrid* grid = job->grid;
+
+    for (size_t s = begin; s < end; ++s) {
+        const uint32_t i = grid->sorted[s];
+        bodies->x[i]            = grid->x[s];
+        bodies->y[i]            = grid->y[s];
+        bodies->velocity_x[i]   = grid->velocity_x[s];
+        bodies->velocity_y[i]   = grid->velocity_y[s];
+    }
+}
+
+// each pair is only looked at once, from whichever body comes first in cell
+// order. that body's own cell and the one to its right are a single run of
+// sorted slots, as are the three cells below it.
+static void _row_job(void* context, size_t begin, size_t end) {
+    CollisionJob* job = context;
+    const CollisionGrid* grid = job->grid;
+    const uint32_t* cell_start = grid->cell_start;
+    const size_t width = grid->width;
+
+    size_t candidate_pairs = 0;
+    size_t contacts = 0;
+
+    for (size_t row = begin; row < end; ++row) {
+        const size_t y = (row * 2) + job->phase;
+        const int has_below = y + 1 < grid->height;
+
+        for (size_t x = 0; x < width; ++x) {
+            const size_t cell = (y * width) + x;
+            const uint32_t first = cell_start[cell];
+            const uint32_t last = cell_start[cell + 1];
+            if (first == last)
+                continue;
+
+            const uint32_t right_end = cell_start[x + 1 < width ? cell + 2 : cell + 1];
+            const size_t below = cell + width;
+            const uint32_t below_begin = has_below ? cell_start[x > 0 ? below - 1 : below] : 0;
+            const uint32_t below_end = has_below ? cell_start[x + 1 < width ? below + 2 : below + 1] : 0;
+
+            for (uint32_t a = first; a < last; ++a) {
+                for (uint32_t b = a + 1; b < right_end; ++b)
+                    contacts += _resolve_pair(&job->gathered, a, b);
+
+                for (uint32_t b = below_begin; b < below_end; ++b)
+                    contacts += _resolve_pair(&job->gathered, a, b);
+
+                candidate_pairs += (right_end - a - 1) + (below_end - below_begin);
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&job->candidate_pairs, candidate_pairs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&job->contacts, contacts, memory_order_relaxed);
+}
+
+// 1 if the pair was touching
+static int _resolve_pair(const PhysicsBodies* bodies, uint32_t a, uint32_t b) {
+    const float dx = bodies->x[b] - bodies->x[a];
+    const float dy = bodies->y[b] - bodies->y[a];
+    const float min_distance = bodies->radius[a] + bodies->radius[b];
+    const float distance_sq = (dx * dx) + (dy * dy);
+
+    if (distance_sq >= min_distance * min_distance)
+        return 0;
+
+    // bodies sitting exactly on top of each other get pushed apart along x
+    const float distance = sqrtf(distance_sq);
+    const float nx = distance > 0.f ? dx / distance : 1.f;
+    const float ny = distance > 0.f ? dy / distance : 0.f;
+
+    const float inv_mass_a = bodies->mass[a] > 0.f ? 1.f / bodies->mass[a] : 0.f;
+    const float inv_mass_b = bodies->mass[b] > 0.f ? 1.f / bodies->mass[b] : 0.f;
+    const float inv_mass_sum = inv_mass_a + inv_mass_b;
+    if (inv_mass_sum <= 0.f)
+        return 1;
+
+    // only push bodies apart if they're moving towards each other
+    const float rel_vx = bodies->velocity_x[b] - bodies->velocity_x[a];
+    const float rel_vy = bodies->velocity_y[b] - bodies->velocity_y[a];
+    const float closing_speed = (rel_vx * nx) + (rel_vy * ny);
+
+    if (closing_speed < 0.f) {
+        const float impulse = -(1.f + RESTITUTION) * closing_speed / inv_mass_sum;
+        bodies->velocity_x[a] -= impulse * inv_mass_a * nx;
+        bodies->velocity_y[a] -= impulse * inv_mass_a * ny;
+        bodies->velocity_x[b] += impulse * inv_mass_b * nx;
+        bodies->velocity_y[b] += impulse * inv_mass_b * ny;
+    }
+
+    const float penetration = min_distance - distance;
+    const float correction = fmaxf(penetration - CORRECTION_SLOP, 0.f) / inv_mass_sum * CORRECTION_PERCENT;
+    bodies->x[a] -= correction * inv_mass_a * nx;
+    bodies->y[a] -= correction * inv_mass_a * ny;
+    bodies->x[b] += correction * inv_mass_b * nx;
+    bodies->y[b] += correction * inv_mass_b * ny;
+
+    return 1;
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,33 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "physics_kernel.h"
+#include "thread_pool.h"
+
+typedef struct {
+    size_t      body_count;
+    size_t      candidate_pairs;    // pairs in neighbouring cells that were tested
+    size_t      contacts;           // pairs found overlapping and resolved
+    float       cell_size;
+    uint64_t    broadphase_ns;
+    uint64_t    narrowphase_ns;
+} CollisionStats;
+
+// scratch space for the broadphase, reused between steps so a steady world
+// doesn't allocate
+typedef struct CollisionGrid CollisionGrid;
+
+CollisionGrid* collision_grid_create(void);
+void collision_grid_destroy(CollisionGrid* grid);
+
+// sorts the bodies into a uniform grid, with cells as wide as the largest
+// collider, then resolves every overlapping pair with an impulse along the
+// contact normal and a positional correction to separate them. rows of cells
+// are split across the pool, and the result doesn't depend on how many
+// workers it has.
+void collision_resolve(CollisionGrid* grid, ThreadPool* pool, const PhysicsBodies* bodies, CollisionStats* o_stats);
+
+#endif // #ifndef COLLISION_H
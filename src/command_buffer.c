@@ -0,0 +1,300 @@
+#include "command_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "profiler.h"
+
+#define INITIAL_COMMAND_CAPACITY 16
+#define COMMAND_QUEUE_ALIGNMENT 64
+
+typedef enum {
+    COMMAND_CREATE_ENTITY = 0,
+    COMMAND_SPAWN_BATCH,
+    COMMAND_DESTROY_ENTITY,
+    COMMAND_ADD_COMPONENT,
+    COMMAND_REMOVE_COMPONENT,
+} CommandType;
+
+typedef struct {
+    size_t          count;
+    ComponentMask   mask;
+    EcsSpawnInit    init;
+    void*           context;
+} SpawnBatchCommand;
+
+typedef struct {
+    CommandType     type;
+    ComponentType   component_type;
+    EntityID        entity;
+    union {
+        EntityDesc              desc;
+        SpawnBatchCommand       batch;
+        PositionComponent       position;
+        DisplayComponent        display;
+        RigidBodyComponent      rigid_body;
+        CircleColliderComponent circle_collider;
+    };
+} Command;
+
+struct CommandBuffer {
+    Command*        commands;
+    size_t          count;
+    size_t          capacity;
+    CommandBuffer*  next;   // link in the submitted queue
+};
+
+// submitted buffers form a lock-free stack. producers push with a cas, and
+// the owner takes the whole stack with one exchange and reverses it back
+// into submission order, so there's no contention between producers beyond
+// retrying the push. the head gets a cache line to itself.
+struct CommandQueue {
+    _Alignas(COMMAND_QUEUE_ALIGNMENT)
+    _Atomic(CommandBuffer*) head;
+};
+
+static Command* _push_command(CommandBuffer* buffer, CommandType type, EntityID entity_id);
+static void _apply_command(EcsWorld* world, const Command* command);
+static CommandBuffer* _take_submitted(CommandQueue* queue);
+
+CommandBuffer* command_buffer_create(void) {
+    return calloc(1, sizeof(CommandBuffer));
+}
+
+void command_buffer_destroy(CommandBuffer* buffer) {
+    if (buffer == NULL)
+        return;
+
+    free(buffer->commands);
+    free(buffer);
+}
+
+int command_buffer_create_entity(CommandBuffer* buffer, const EntityDesc* desc) {
+    Command* command = _push_command(buffer, COMMAND_CREATE_ENTITY, INVALID_ENTITY_ID);
+    if (command == NULL)
+        return 0;
+
+    command->desc = *desc;
+    return 1;
+}
+
+int command_buffer_spawn_batch(CommandBuffer* buffer, const size_t count, const ComponentMask mask, EcsSpawnInit init, void* context) {
+    Command* command = _push_command(buffer, COMMAND_SPAWN_BATCH, INVALID_ENTITY_ID);
+    if (command == NULL)
+        return 0;
+
+    command->batch = (SpawnBatchCommand) {
+        .count      = count,
+        .mask       = mask,
+        .init       = init,
+        .context    = context,
+    };
+    return 1;
+}
+
+int command_buffer_destroy_entity(CommandBuffer* buffer, const EntityID entity_id) {
+    return _push_command(buffer, COMMAND_DESTROY_ENTITY, entity_id) != NULL;
+}
+
+int command_buffer_add_position(CommandBuffer* buffer, const EntityID entity_id, const PositionComponent* component) {
+    Command* command = _push_command(buffer, COMMAND_ADD_COMPONENT, entity_id);
+    if (command == NULL)
+        return 0;
+
+    command->component_type = COMPONENT_TYPE_POSITION;
+    command->position = *component;
+    return 1;
+}
+
+int command_buffer_add_display(CommandBuffer* buffer, const EntityID entity_id, const DisplayComponent* component) {
+    Command* command = _push_command(buffer, COMMAND_ADD_COMPONENT, entity_id);
+    if (command == NULL)
+        return 0;
+
+    command->component_type = COMPONENT_TYPE_DISPLAY;
+    command->display = *component;
+    return 1;
+}
+
+int command_buffer_add_rigid_body(CommandBuffer* buffer, const EntityID entity_id, const RigidBodyComponent* component) {
+    Command* command = _push_command(buffer, COMMAND_ADD_COMPONENT, entity_id);
+    if (command == NULL)
+        return 0;
+
+    command->component_type = COMPONENT_TYPE_RIGID_BODY;
+    command->rigid_body = *component;
+    return 1;
+}
+
+int command_buffer_add_circle_collider(CommandBuffer* buffer, const EntityID entity_id, const CircleColliderComponent* component) {
+    Command* command = _push_command(buffer, COMMAND_ADD_COMPONENT, entity_id);
+    if (command == NULL)
+        return 0;
+
+    command->component_type = COMPONENT_TYPE_CIRCLE_COLLIDER;
+    command->circle_collider = *component;
+    return 1;
+}
+
+int command_buffer_remove_component(CommandBuffer* buffer, const EntityID entity_id, const ComponentType type) {
+    if (type >= COMPONENT_TYPE_COUNT)
+        return 0;
+
+    Command* command = _push_command(buffer, COMMAND_REMOVE_COMPONENT, entity_id);
+    if (command == NULL)
+        return 0;
+
+    command->component_type = type;
+    return 1;
+}
+
+size_t command_buffer_count(const CommandBuffer* buffer) {
+    return buffer->count;
+}
+
+void command_buffer_submit(CommandQueue* queue, CommandBuffer* buffer) {
+    if (buffer == NULL)
+        return;
+
+    CommandBuffer* head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    do {
+        buffer->next = head;
+    } while (! atomic_compare_exchange_weak_explicit(&queue->head, &head, buffer,
+        memory_order_release, memory_order_relaxed));
+}
+
+CommandQueue* command_queue_create(void) {
+    CommandQueue* queue = aligned_alloc(_Alignof(CommandQueue), sizeof(CommandQueue));
+    if (queue == NULL)
+        return NULL;
+
+    atomic_init(&queue->head, NULL);
+    return queue;
+}
+
+void command_queue_destroy(CommandQueue* queue) {
+    if (queue == NULL)
+        return;
+
+    CommandBuffer* buffer = _take_submitted(queue);
+    while (buffer != NULL) {
+        CommandBuffer* next = buffer->next;
+        command_buffer_destroy(buffer);
+        buffer = next;
+    }
+
+    free(queue);
+}
+
+size_t command_queue_apply(CommandQueue* queue, EcsWorld* world) {
+    CommandBuffer* buffer = _take_submitted(queue);
+    if (buffer == NULL)
+        return 0;
+
+    PROFILE_SCOPE("apply_commands");
+
+    size_t applied = 0;
+    while (buffer != NULL) {
+        CommandBuffer* next = buffer->next;
+
+        for (size_t i = 0; i < buffer->count; ++i)
+            _apply_command(world, &buffer->commands[i]);
+
+        applied += buffer->count;
+        command_buffer_destroy(buffer);
+        buffer = next;
+    }
+
+    return applied;
+}
+
+static Command* _push_command(CommandBuffer* buffer, CommandType type, EntityID entity_id) {
+    if (buffer->count == buffer->capacity) {
+        const size_t new_capacity = buffer->capacity > 0 ? buffer->capacity*2 : INITIAL_COMMAND_CAPACITY;
+        Command* commands = realloc(buffer->commands, sizeof(Command)*new_capacity);
+        if (commands == NULL) {
+            fprintf(stderr, "ERROR: failed to grow command buffer to %zu commands\n", new_capacity);
+            return NULL;
+        }
+
+        buffer->commands = commands;
+        buffer->capacity = new_capacity;
+    }
+
+    Command* command = &buffer->commands[buffer->count++];
+    memset(command, 0, sizeof(Command));
+    command->type = type;
+    command->entity = entity_id;
+    return command;
+}
+
+static void _apply_command(EcsWorld* world, const Command* command) {
+    switch (command->type) {
+        case COMMAND_CREATE_ENTITY: {
+            const EntityDesc* desc = &command->desc;
+            const EntityID id = ecs_new_entity(world);
+            if (id == INVALID_ENTITY_ID)
+                break;
+
+            if (desc->mask & COMPONENT_POSITION)
+                ecs_new_position_component(world, id, &desc->position);
+            if (desc->mask & COMPONENT_DISPLAY)
+                ecs_new_display_component(world, id, &desc->display);
+            if (desc->mask & COMPONENT_RIGID_BODY)
+                ecs_new_rigid_body_component(world, id, &desc->rigid_body);
+            if (desc->mask & COMPONENT_CIRCLE_COLLIDER)
+                ecs_new_circle_collider_component(world, id, &desc->circle_collider);
+            break;
+        }
+
+        case COMMAND_SPAWN_BATCH: {
+            const SpawnBatchCommand* batch = &command->batch;
+            if (! ecs_spawn_batch(world, batch->count, batch->mask, batch->init, batch->context, NULL))
+                fprintf(stderr, "ERROR: failed to spawn a deferred batch of %zu entities\n", batch->count);
+            break;
+        }
+
+        case COMMAND_DESTROY_ENTITY:
+            ecs_destroy_entity(world, command->entity);
+            break;
+
+        case COMMAND_ADD_COMPONENT:
+            switch (command->component_type) {
+                case COMPONENT_TYPE_POSITION:
+                    ecs_new_position_component(world, command->entity, &command->position);
+                    break;
+                case COMPONENT_TYPE_DISPLAY:
+                    ecs_new_display_component(world, command->entity, &command->display);
+                    break;
+                case COMPONENT_TYPE_RIGID_BODY:
+                    ecs_new_rigid_body_component(world, command->entity, &command->rigid_body);
+                    break;
+                case COMPONENT_TYPE_CIRCLE_COLLIDER:
+                    ecs_new_circle_collider_component(world, command->entity, &command->circle_collider);
+                    break;
+                default:
+                    break;
+            }
+            break;
+
+        case COMMAND_REMOVE_COMPONENT:
+            ecs_remove_component(world, command->entity, command->component_type);
+            break;
+    }
+}
+
+static CommandBuffer* _take_submitted(CommandQueue* queue) {
+    CommandBuffer* head = atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+
+    // the stack comes out newest first, flip it back into submission order
+    CommandBuffer* ordered = NULL;
+    while (head != NULL) {
+        CommandBuffer* next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+
+    return ordered;
+}
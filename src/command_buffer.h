@@ -0,0 +1,60 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <stdlib.h>
+
+#include "ecs.h"
+
+// structural changes recorded by any thread and applied later by whichever
+// thread owns the world. a buffer is filled privately, then submitted to a
+// lock-free queue, so recording and submitting never wait on the simulation.
+typedef struct CommandBuffer CommandBuffer;
+
+// where buffers wait to be applied. each world's owner keeps its own queue,
+// so producers for different worlds never touch the same memory.
+typedef struct CommandQueue CommandQueue;
+
+// components an entity is created with. only those in mask are added
+typedef struct {
+    ComponentMask           mask;
+    PositionComponent       position;
+    DisplayComponent        display;
+    RigidBodyComponent      rigid_body;
+    CircleColliderComponent circle_collider;
+} EntityDesc;
+
+CommandBuffer* command_buffer_create(void);
+
+// only for buffers that were never submitted, submitting hands the buffer over
+void command_buffer_destroy(CommandBuffer* buffer);
+
+// recording. the record functions return 0 if the command couldn't be stored.
+// entities passed in are checked when the command is applied, so commands on
+// entities that have since been destroyed are skipped
+int command_buffer_create_entity(CommandBuffer* buffer, const EntityDesc* desc);
+int command_buffer_spawn_batch(CommandBuffer* buffer, const size_t count, const ComponentMask mask, EcsSpawnInit init, void* context);
+int command_buffer_destroy_entity(CommandBuffer* buffer, const EntityID entity_id);
+int command_buffer_add_position(CommandBuffer* buffer, const EntityID entity_id, const PositionComponent* component);
+int command_buffer_add_display(CommandBuffer* buffer, const EntityID entity_id, const DisplayComponent* component);
+int command_buffer_add_rigid_body(CommandBuffer* buffer, const EntityID entity_id, const RigidBodyComponent* component);
+int command_buffer_add_circle_collider(CommandBuffer* buffer, const EntityID entity_id, const CircleColliderComponent* component);
+int command_buffer_remove_component(CommandBuffer* buffer, const EntityID entity_id, const ComponentType type);
+
+size_t command_buffer_count(const CommandBuffer* buffer);
+
+// safe from any thread. the buffer is owned by the queue afterwards and freed
+// once it's been applied. spawn callbacks run on the applying thread, so
+// their context has to stay alive until then
+void command_buffer_submit(CommandQueue* queue, CommandBuffer* buffer);
+
+CommandQueue* command_queue_create(void);
+
+// frees anything still queued without applying it
+void command_queue_destroy(CommandQueue* queue);
+
+// owner side, with the world locked. applies every submitted buffer in
+// submission order, commands within a buffer in the order they were recorded,
+// and returns how many commands were applied
+size_t command_queue_apply(CommandQueue* queue, EcsWorld* world);
+
+#endif // #ifndef COMMAND_BUFFER_H
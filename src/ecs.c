@@ -1,183 +1,1236 @@
 #include "ecs.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "profiler.h"
+#include "vmem.h"
+
+#define MAX_POOL_COLUMNS 4
+#define MAX_COLUMN_ELEMENT_SIZE 16
+#define OWNER_COLUMN 0
+
+// sparse set over a structure of arrays. every column is packed so the first
+// `count` slots are always in use, and `sparse` maps an entity's index to its
+// slot. a sparse entry is only trusted if the slot it points at is in range
+// and owned by that exact entity, generation included, so stale or zeroed
+// entries never need clearing.
+//
+// each column lives in its own reserved range, so columns never move as the
+// pool grows and only the slots that have been used are ever backed by memory.
+typedef struct {
+    size_t          column_count;
+    size_t          column_sizes[MAX_POOL_COLUMNS];
+    unsigned char*  columns[MAX_POOL_COLUMNS];
+    VirtualRange    ranges[MAX_POOL_COLUMNS];
+    size_t          count;
+    size_t          capacity;
+    uint32_t*       sparse;
+
+    // change version of each chunk of ECS_CHANGE_CHUNK_SIZE slots, one for
+    // every chunk the pool has capacity for
+    EcsVersion*     versions;
+
+    // the group this pool was last packed into, kept until something changes
+    // the pool's structure so regrouping an untouched world is free. kept per
+    // pool so groups over disjoint pools never share state.
+    ComponentMask   group_mask;
+    size_t          group_count;
+} ComponentPool;
+
+enum { POSITION_COLUMN_X = 1, POSITION_COLUMN_Y };
+enum { DISPLAY_COLUMN_RADIUS = 1, DISPLAY_COLUMN_COLOR };
+enum { RIGID_BODY_COLUMN_MASS = 1, RIGID_BODY_COLUMN_VELOCITY_X, RIGID_BODY_COLUMN_VELOCITY_Y };
+enum { CIRCLE_COLLIDER_COLUMN_RADIUS = 1 };
+
+static const size_t s_pool_column_sizes[COMPONENT_TYPE_COUNT][MAX_POOL_COLUMNS] = {
+    [COMPONENT_TYPE_POSITION]           = { sizeof(EntityID), sizeof(float), sizeof(float) },
+    [COMPONENT_TYPE_DISPLAY]            = { sizeof(EntityID), sizeof(float), sizeof(Color) },
+    [COMPONENT_TYPE_RIGID_BODY]         = { sizeof(EntityID), sizeof(float), sizeof(float), sizeof(float) },
+    [COMPONENT_TYPE_CIRCLE_COLLIDER]    = { sizeof(EntityID), sizeof(float) },
+};
+
+#define COLUMN(type, column, elem_type) ((elem_type*)world->pools[type].columns[column])
+
+#define INITIAL_ENTITY_CAPACITY 1024
+#define INITIAL_POOL_CAPACITY 1024
+
+// snapshot files are a header followed by one section per entity array and
+// pool column. every section starts on a page boundary of the machine that
+// wrote it, so a loader with the same page size can map columns straight
+// into its pools. sections are stored in native byte order, and the endian
+// mark and element sizes catch files written by an incompatible build.
+#define SNAPSHOT_MAGIC "CECSSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ENDIAN_MARK 0x01020304u
 
 typedef struct {
-    PositionComponent*          positions;
-    size_t                      position_count;
-    DisplayComponent*           displays;
-    size_t                      display_count;
-    RigidBodyComponent*         rigid_bodies;
-    size_t                      rigid_body_count;
-    CircleColliderComponent*    circle_colliders;
-    size_t                      circle_collider_count;
-} Components;
-
-static EntityID         s_next_entity       = 1;
-static Components       s_components;
-static size_t           s_max_components    = 0;
-static unsigned char*   s_components_buffer = NULL;
-static pthread_mutex_t  s_lock;
-
-static void* _get_component(void* component_array, size_t stride, EntityID entity_id);
-static void* _get_free_component(void* component_array, size_t stride);
-
-void ecs_init(const size_t max_components) {
-    if (s_components_buffer != NULL)
+    uint64_t        count;
+    uint64_t        column_sizes[MAX_POOL_COLUMNS];
+    uint64_t        column_offsets[MAX_POOL_COLUMNS];
+} SnapshotPool;
+
+typedef struct {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        endian_mark;
+    uint64_t        alignment;
+    uint64_t        file_size;
+    uint64_t        next_index;
+    uint64_t        free_count;
+    uint64_t        live_count;
+    uint64_t        generations_offset;
+    uint64_t        alive_offset;
+    uint64_t        free_indices_offset;
+    uint32_t        component_type_count;
+    uint32_t        max_pool_columns;
+    uint32_t        entity_index_bits;
+    uint32_t        reserved;
+    SnapshotPool    pools[COMPONENT_TYPE_COUNT];
+} SnapshotHeader;
+
+// everything a world owns lives here, so worlds never share state. worlds
+// start on their own cache line, so two worlds stepped on different cores
+// never share one either.
+struct EcsWorld {
+    _Alignas(ECS_COLUMN_ALIGNMENT)
+    pthread_mutex_t lock;
+    ComponentPool   pools[COMPONENT_TYPE_COUNT];
+    size_t          reserved_components;
+
+    // entity slots. index 0 is never handed out so INVALID_ENTITY_ID stays
+    // invalid. freed slots are reused last in first out, and every array here
+    // is sized to entity_capacity, as are the pools' sparse arrays.
+    size_t          entity_capacity;
+    size_t          next_index;
+    uint32_t*       generations;
+    uint8_t*        alive;
+    uint32_t*       free_indices;
+    size_t          free_count;
+    size_t          live_count;
+
+    EcsVersion      change_version;
+
+    // who took the lock and when, only kept with ECS_ENABLE_LOCK_STATS
+    const char*     lock_site;
+    uint64_t        lock_acquired_ns;
+};
+
+static int _new_component(EcsWorld* world, ComponentType type, EntityID entity_id, size_t* o_index);
+static int _get_component_index(const EcsWorld* world, ComponentType type, EntityID entity_id, size_t* o_index);
+static int _get_pool_index(const ComponentPool* pool, EntityID entity_id, size_t* o_index);
+static int _remove_component(EcsWorld* world, ComponentType type, EntityID entity_id);
+static void _swap_pool_slots(ComponentPool* pool, size_t a, size_t b);
+static void _mark_pool_changed(ComponentPool* pool, size_t begin, size_t end, EcsVersion version);
+static int _is_changed(const EcsWorld* world, ComponentMask changed, const size_t* index, EcsVersion since);
+static int _is_grouped(const EcsWorld* world, ComponentMask mask);
+static ComponentType _first_component_type(ComponentMask mask);
+static int _grow_pool(EcsWorld* world, ComponentPool* pool, size_t min_capacity);
+static int _grow_versions(ComponentPool* pool, size_t capacity);
+static int _grow_entities(EcsWorld* world, size_t min_capacity);
+static int _check_snapshot_header(const SnapshotHeader* header, const size_t file_size);
+static int _check_snapshot_entities(const EcsWorld* world, uint8_t* seen);
+static int _load_snapshot_section(const int fd, const size_t offset, void* data, const size_t size);
+static int _write_snapshot_section(const int fd, const size_t offset, const void* data, const size_t size);
+static size_t _align_up(size_t size, size_t alignment);
+#ifdef ECS_ENABLE_LOCK_STATS
+static uint64_t _now_ns(void);
+#endif
+
+EcsWorld* ecs_world_create(const EcsConfig* config) {
+    EcsWorld* world = aligned_alloc(_Alignof(EcsWorld), sizeof(EcsWorld));
+    if (world == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate an ecs world\n");
+        return NULL;
+    }
+
+    memset(world, 0, sizeof(EcsWorld));
+    pthread_mutex_init(&world->lock, NULL);
+
+    world->next_index = 1;
+    world->change_version = 1;
+    world->reserved_components = config != NULL ? config->reserved_components : ECS_DEFAULT_RESERVED_COMPONENTS;
+    if (world->reserved_components > ECS_MAX_ENTITIES)
+        world->reserved_components = ECS_MAX_ENTITIES;
+    const int huge_pages = config != NULL ? config->huge_pages : 0;
+
+    // reserve address space for every column up front. nothing is committed
+    // until a pool first needs the room.
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        ComponentPool* pool = &world->pools[type];
+        for (size_t col = 0; col < MAX_POOL_COLUMNS && s_pool_column_sizes[type][col] != 0; ++col) {
+            pool->column_sizes[col] = s_pool_column_sizes[type][col];
+            if (! vmem_reserve(&pool->ranges[col], pool->column_sizes[col]*world->reserved_components, huge_pages)) {
+                // a pool missing a column can't hold anything, leave it empty
+                for (size_t i = 0; i < col; ++i)
+                    vmem_release(&pool->ranges[i]);
+                pool->column_count = 0;
+                break;
+            }
+
+            pool->columns[col] = pool->ranges[col].base;
+            pool->column_count++;
+        }
+    }
+
+    if (! _grow_entities(world, INITIAL_ENTITY_CAPACITY)) {
+        ecs_world_destroy(world);
+        return NULL;
+    }
+
+    return world;
+}
+
+void ecs_world_destroy(EcsWorld* world) {
+    if (world == NULL)
         return;
 
-    pthread_mutex_init(&s_lock, NULL);
+    pthread_mutex_destroy(&world->lock);
+
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        for (size_t col = 0; col < world->pools[i].column_count; ++col)
+            vmem_release(&world->pools[i].ranges[col]);
+        free(world->pools[i].sparse);
+        free(world->pools[i].versions);
+    }
+
+    free(world->generations);
+    free(world->alive);
+    free(world->free_indices);
+    free(world);
+}
+
+void ecs_lock_mutex_at(EcsWorld* world, const char* site) {
+    PROFILE_SCOPE("ecs_lock_wait");
+
+#ifdef ECS_ENABLE_LOCK_STATS
+    // a failed try is what tells a contended acquisition from a free one
+    const uint64_t start_ns = _now_ns();
+    const int contended = pthread_mutex_trylock(&world->lock) != 0;
+    if (contended)
+        pthread_mutex_lock(&world->lock);
+
+    world->lock_site = site;
+    world->lock_acquired_ns = _now_ns();
+    lock_stats_record_wait(site, contended, world->lock_acquired_ns - start_ns);
+#else
+    (void)site;
+    pthread_mutex_lock(&world->lock);
+#endif
+}
+
+void ecs_unlock_mutex(EcsWorld* world) {
+#ifdef ECS_ENABLE_LOCK_STATS
+    // read while still held, the next owner overwrites them
+    const char* site = world->lock_site;
+    const uint64_t hold_ns = _now_ns() - world->lock_acquired_ns;
+    pthread_mutex_unlock(&world->lock);
+    lock_stats_record_hold(site, hold_ns);
+#else
+    pthread_mutex_unlock(&world->lock);
+#endif
+}
+
+EntityID ecs_new_entity(EcsWorld* world) {
+    size_t index;
+    if (world->free_count > 0) {
+        index = world->free_indices[--world->free_count];
+    } else {
+        if (world->next_index > ECS_ENTITY_INDEX_MASK)
+            return INVALID_ENTITY_ID;
+
+        if (world->next_index >= world->entity_capacity && ! _grow_entities(world, world->next_index + 1))
+            return INVALID_ENTITY_ID;
+
+        index = world->next_index++;
+    }
+
+    world->alive[index] = 1;
+    world->live_count++;
+
+    return ((EntityID)world->generations[index] << ECS_ENTITY_INDEX_BITS) | (EntityID)index;
+}
+
+int ecs_destroy_entity(EcsWorld* world, const EntityID entity_id) {
+    if (! ecs_is_alive(world, entity_id))
+        return 0;
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type)
+        _remove_component(world, type, entity_id);
+
+    // bumping the generation is what makes every outstanding handle stale
+    const size_t index = ECS_ENTITY_INDEX(entity_id);
+    world->generations[index] = (world->generations[index] + 1) & ECS_ENTITY_GENERATION_MASK;
+    world->alive[index] = 0;
+    world->free_indices[world->free_count++] = index;
+    world->live_count--;
+
+    return 1;
+}
+
+int ecs_is_alive(const EcsWorld* world, const EntityID entity_id) {
+    const size_t index = ECS_ENTITY_INDEX(entity_id);
+    if (index == 0 || index >= world->next_index)
+        return 0;
+
+    return world->alive[index] && world->generations[index] == ECS_ENTITY_GENERATION(entity_id);
+}
+
+size_t ecs_entity_count(const EcsWorld* world) {
+    return world->live_count;
+}
+
+void ecs_get_memory_stats(const EcsWorld* world, EcsMemoryStats* o_stats) {
+    memset(o_stats, 0, sizeof(EcsMemoryStats));
+
+    o_stats->entity_count = world->live_count;
+    o_stats->entity_capacity = world->entity_capacity;
+    o_stats->bytes_per_entity = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+    o_stats->committed_bytes = (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t))*world->entity_capacity;
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        const ComponentPool* pool = &world->pools[type];
+        EcsPoolMemory* memory = &o_stats->pools[type];
+
+        const size_t version_chunks = (pool->capacity + ECS_CHANGE_CHUNK_SIZE - 1) / ECS_CHANGE_CHUNK_SIZE;
+        memory->count = pool->count;
+        memory->capacity = pool->capacity;
+        memory->bytes_per_entity = sizeof(uint32_t) + (double)sizeof(EcsVersion) / ECS_CHANGE_CHUNK_SIZE;
+        memory->committed_bytes = sizeof(uint32_t)*world->entity_capacity + sizeof(EcsVersion)*version_chunks;
+
+        for (size_t col = 0; col < pool->column_count; ++col) {
+            memory->bytes_per_entity += pool->column_sizes[col];
+            memory->committed_bytes += pool->ranges[col].committed;
+        }
+
+        o_stats->committed_bytes += memory->committed_bytes;
+    }
+}
+
+int ecs_new_position_component(EcsWorld* world, const EntityID entity_id, const PositionComponent* component) {
+    size_t index;
+    if (! _new_component(world, COMPONENT_TYPE_POSITION, entity_id, &index))
+        return 0;
+
+    COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_X, float)[index] = component->pos.x;
+    COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_Y, float)[index] = component->pos.y;
+    return 1;
+}
+
+int ecs_new_display_component(EcsWorld* world, const EntityID entity_id, const DisplayComponent* component) {
+    size_t index;
+    if (! _new_component(world, COMPONENT_TYPE_DISPLAY, entity_id, &index))
+        return 0;
+
+    COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_RADIUS, float)[index] = component->radius;
+    COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_COLOR, Color)[index] = component->color;
+    return 1;
+}
+
+int ecs_new_rigid_body_component(EcsWorld* world, const EntityID entity_id, const RigidBodyComponent* component) {
+    size_t index;
+    if (! _new_component(world, COMPONENT_TYPE_RIGID_BODY, entity_id, &index))
+        return 0;
+
+    COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_MASS, float)[index] = component->mass;
+    COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_X, float)[index] = component->velocity.x;
+    COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_Y, float)[index] = component->velocity.y;
+    return 1;
+}
+
+int ecs_new_circle_collider_component(EcsWorld* world, const EntityID entity_id, const CircleColliderComponent* component) {
+    size_t index;
+    if (! _new_component(world, COMPONENT_TYPE_CIRCLE_COLLIDER, entity_id, &index))
+        return 0;
+
+    COLUMN(COMPONENT_TYPE_CIRCLE_COLLIDER, CIRCLE_COLLIDER_COLUMN_RADIUS, float)[index] = component->radius;
+    return 1;
+}
+
+int ecs_get_position_component(const EcsWorld* world, const EntityID entity_id, PositionComponent* o_component) {
+    size_t index;
+    if (! _get_component_index(world, COMPONENT_TYPE_POSITION, entity_id, &index))
+        return 0;
+
+    o_component->pos.x = COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_X, float)[index];
+    o_component->pos.y = COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_Y, float)[index];
+    return 1;
+}
+
+int ecs_get_display_component(const EcsWorld* world, const EntityID entity_id, DisplayComponent* o_component) {
+    size_t index;
+    if (! _get_component_index(world, COMPONENT_TYPE_DISPLAY, entity_id, &index))
+        return 0;
+
+    o_component->radius = COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_RADIUS, float)[index];
+    o_component->color = COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_COLOR, Color)[index];
+    return 1;
+}
+
+int ecs_get_rigid_body_component(const EcsWorld* world, const EntityID entity_id, RigidBodyComponent* o_component) {
+    size_t index;
+    if (! _get_component_index(world, COMPONENT_TYPE_RIGID_BODY, entity_id, &index))
+        return 0;
+
+    o_component->mass = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_MASS, float)[index];
+    o_component->velocity.x = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_X, float)[index];
+    o_component->velocity.y = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_Y, float)[index];
+    return 1;
+}
+
+int ecs_get_circle_collider_component(const EcsWorld* world, const EntityID entity_id, CircleColliderComponent* o_component) {
+    size_t index;
+    if (! _get_component_index(world, COMPONENT_TYPE_CIRCLE_COLLIDER, entity_id, &index))
+        return 0;
+
+    o_component->radius = COLUMN(COMPONENT_TYPE_CIRCLE_COLLIDER, CIRCLE_COLLIDER_COLUMN_RADIUS, float)[index];
+    return 1;
+}
+
+int ecs_set_position_component(EcsWorld* world, const EntityID entity_id, const PositionComponent* component) {
+    if (! ecs_has_component(world, entity_id, COMPONENT_TYPE_POSITION))
+        return 0;
+
+    return ecs_new_position_component(world, entity_id, component);
+}
+
+int ecs_set_display_component(EcsWorld* world, const EntityID entity_id, const DisplayComponent* component) {
+    if (! ecs_has_component(world, entity_id, COMPONENT_TYPE_DISPLAY))
+        return 0;
+
+    return ecs_new_display_component(world, entity_id, component);
+}
+
+int ecs_set_rigid_body_component(EcsWorld* world, const EntityID entity_id, const RigidBodyComponent* component) {
+    if (! ecs_has_component(world, entity_id, COMPONENT_TYPE_RIGID_BODY))
+        return 0;
+
+    return ecs_new_rigid_body_component(world, entity_id, component);
+}
+
+int ecs_set_circle_collider_component(EcsWorld* world, const EntityID entity_id, const CircleColliderComponent* component) {
+    if (! ecs_has_component(world, entity_id, COMPONENT_TYPE_CIRCLE_COLLIDER))
+        return 0;
+
+    return ecs_new_circle_collider_component(world, entity_id, component);
+}
+
+int ecs_remove_position_component(EcsWorld* world, const EntityID entity_id) {
+    return _remove_component(world, COMPONENT_TYPE_POSITION, entity_id);
+}
+
+int ecs_remove_display_component(EcsWorld* world, const EntityID entity_id) {
+    return _remove_component(world, COMPONENT_TYPE_DISPLAY, entity_id);
+}
+
+int ecs_remove_rigid_body_component(EcsWorld* world, const EntityID entity_id) {
+    return _remove_component(world, COMPONENT_TYPE_RIGID_BODY, entity_id);
+}
+
+int ecs_remove_circle_collider_component(EcsWorld* world, const EntityID entity_id) {
+    return _remove_component(world, COMPONENT_TYPE_CIRCLE_COLLIDER, entity_id);
+}
+
+int ecs_remove_component(EcsWorld* world, const EntityID entity_id, const ComponentType type) {
+    if (type >= COMPONENT_TYPE_COUNT)
+        return 0;
+
+    return _remove_component(world, type, entity_id);
+}
+
+int ecs_has_component(const EcsWorld* world, const EntityID entity_id, const ComponentType type) {
+    size_t index;
+    return _get_component_index(world, type, entity_id, &index);
+}
+
+void ecs_get_position_columns(EcsWorld* world, PositionColumns* o_columns) {
+    *o_columns = (PositionColumns) {
+        .owners = COLUMN(COMPONENT_TYPE_POSITION, OWNER_COLUMN, EntityID),
+        .x      = COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_X, float),
+        .y      = COLUMN(COMPONENT_TYPE_POSITION, POSITION_COLUMN_Y, float),
+        .count  = world->pools[COMPONENT_TYPE_POSITION].count,
+    };
+}
+
+void ecs_get_display_columns(EcsWorld* world, DisplayColumns* o_columns) {
+    *o_columns = (DisplayColumns) {
+        .owners = COLUMN(COMPONENT_TYPE_DISPLAY, OWNER_COLUMN, EntityID),
+        .radius = COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_RADIUS, float),
+        .color  = COLUMN(COMPONENT_TYPE_DISPLAY, DISPLAY_COLUMN_COLOR, Color),
+        .count  = world->pools[COMPONENT_TYPE_DISPLAY].count,
+    };
+}
+
+void ecs_get_rigid_body_columns(EcsWorld* world, RigidBodyColumns* o_columns) {
+    *o_columns = (RigidBodyColumns) {
+        .owners     = COLUMN(COMPONENT_TYPE_RIGID_BODY, OWNER_COLUMN, EntityID),
+        .mass       = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_MASS, float),
+        .velocity_x = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_X, float),
+        .velocity_y = COLUMN(COMPONENT_TYPE_RIGID_BODY, RIGID_BODY_COLUMN_VELOCITY_Y, float),
+        .count      = world->pools[COMPONENT_TYPE_RIGID_BODY].count,
+    };
+}
+
+void ecs_get_circle_collider_columns(EcsWorld* world, CircleColliderColumns* o_columns) {
+    *o_columns = (CircleColliderColumns) {
+        .owners = COLUMN(COMPONENT_TYPE_CIRCLE_COLLIDER, OWNER_COLUMN, EntityID),
+        .radius = COLUMN(COMPONENT_TYPE_CIRCLE_COLLIDER, CIRCLE_COLLIDER_COLUMN_RADIUS, float),
+        .count  = world->pools[COMPONENT_TYPE_CIRCLE_COLLIDER].count,
+    };
+}
+
+int ecs_spawn_batch(EcsWorld* world, const size_t count, const ComponentMask mask, EcsSpawnInit init, void* context, EntityID* o_ids) {
+    if (count == 0)
+        return 1;
+
+    // make room everywhere before touching anything, so a batch that doesn't
+    // fit leaves the world as it was
+    const size_t recycled = count < world->free_count ? count : world->free_count;
+    const size_t fresh = count - recycled;
+    if (fresh > 0) {
+        if (world->next_index + fresh - 1 > ECS_ENTITY_INDEX_MASK)
+            return 0;
+
+        if (world->next_index + fresh > world->entity_capacity && ! _grow_entities(world, world->next_index + fresh))
+            return 0;
+    }
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        ComponentPool* pool = &world->pools[type];
+        if ((mask & COMPONENT_MASK(type)) && pool->count + count > pool->capacity && ! _grow_pool(world, pool, pool->count + count))
+            return 0;
+    }
+
+    // every pool hands out the same sized run of slots off its end
+    size_t first[COMPONENT_TYPE_COUNT] = { 0 };
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        if (! (mask & COMPONENT_MASK(type)))
+            continue;
+
+        ComponentPool* pool = &world->pools[type];
+        first[type] = pool->count;
+        pool->count += count;
+        pool->group_mask = 0;
+        _mark_pool_changed(pool, first[type], pool->count, world->change_version);
+
+        for (size_t col = OWNER_COLUMN + 1; col < pool->column_count; ++col) {
+            const size_t size = pool->column_sizes[col];
+            memset(pool->columns[col] + (first[type] * size), 0, count * size);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t index = i < recycled ? world->free_indices[--world->free_count] : world->next_index++;
+        world->alive[index] = 1;
+
+        const EntityID id = ((EntityID)world->generations[index] << ECS_ENTITY_INDEX_BITS) | (EntityID)index;
+        if (o_ids != NULL)
+            o_ids[i] = id;
+
+        for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+            if (! (mask & COMPONENT_MASK(type)))
+                continue;
+
+            ComponentPool* pool = &world->pools[type];
+            ((EntityID*)pool->columns[OWNER_COLUMN])[first[type] + i] = id;
+            pool->sparse[index] = first[type] + i;
+        }
+    }
+
+    world->live_count += count;
+
+    if (init == NULL)
+        return 1;
 
-    memset(&s_components, 0, sizeof(s_components));
+    EcsSpawnBatch batch = { .ids = o_ids, .count = count };
+    if (mask & COMPONENT_POSITION) {
+        const size_t offset = first[COMPONENT_TYPE_POSITION];
+        ecs_get_position_columns(world, &batch.position);
+        batch.position.owners += offset;
+        batch.position.x += offset;
+        batch.position.y += offset;
+        batch.position.count = count;
+        batch.ids = batch.position.owners;
+    }
+
+    if (mask & COMPONENT_DISPLAY) {
+        const size_t offset = first[COMPONENT_TYPE_DISPLAY];
+        ecs_get_display_columns(world, &batch.display);
+        batch.display.owners += offset;
+        batch.display.radius += offset;
+        batch.display.color += offset;
+        batch.display.count = count;
+        batch.ids = batch.display.owners;
+    }
+
+    if (mask & COMPONENT_RIGID_BODY) {
+        const size_t offset = first[COMPONENT_TYPE_RIGID_BODY];
+        ecs_get_rigid_body_columns(world, &batch.rigid_body);
+        batch.rigid_body.owners += offset;
+        batch.rigid_body.mass += offset;
+        batch.rigid_body.velocity_x += offset;
+        batch.rigid_body.velocity_y += offset;
+        batch.rigid_body.count = count;
+        batch.ids = batch.rigid_body.owners;
+    }
+
+    if (mask & COMPONENT_CIRCLE_COLLIDER) {
+        const size_t offset = first[COMPONENT_TYPE_CIRCLE_COLLIDER];
+        ecs_get_circle_collider_columns(world, &batch.circle_collider);
+        batch.circle_collider.owners += offset;
+        batch.circle_collider.radius += offset;
+        batch.circle_collider.count = count;
+        batch.ids = batch.circle_collider.owners;
+    }
+
+    init(context, &batch);
+    return 1;
+}
 
-    s_max_components = max_components;
-    const size_t positions_array_size           = sizeof(PositionComponent)*s_max_components;
-    const size_t displays_array_size            = sizeof(DisplayComponent)*s_max_components;
-    const size_t rigid_bodies_array_size        = sizeof(RigidBodyComponent)*s_max_components;
-    const size_t circle_colliders_array_size    = sizeof(CircleColliderComponent)*s_max_components;
+EcsQuery ecs_query(const EcsWorld* world, const ComponentMask mask) {
+    EcsQuery query;
+    memset(&query, 0, sizeof(query));
+    query.world = world;
+    query.mask = mask;
 
-    // allocate a shared buffer for all components to live in and zero it out
-    const size_t total_buffer_size = positions_array_size + displays_array_size + rigid_bodies_array_size + circle_colliders_array_size;
-    s_components_buffer = malloc(total_buffer_size);
-    memset(s_components_buffer, 0, total_buffer_size);
+    // drive from the smallest pool so we visit as few non-matching entities as possible
+    size_t driver_count = SIZE_MAX;
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        if (! (mask & COMPONENT_MASK(i)))
+            continue;
 
-    // allocate a portion of the shared buffer to each component array
-    unsigned char* buffer_offset = s_components_buffer;
-    s_components.positions = (void*)buffer_offset;
-    buffer_offset += positions_array_size;
+        if (world->pools[i].count < driver_count) {
+            driver_count = world->pools[i].count;
+            query.driver = i;
+        }
+    }
+
+    // an empty mask matches nothing rather than everything
+    if (driver_count == SIZE_MAX)
+        query.mask = 0;
+
+    return query;
+}
+
+int ecs_query_next(EcsQuery* query) {
+    if (query->mask == 0)
+        return 0;
 
-    s_components.displays = (void*)buffer_offset;
-    buffer_offset += displays_array_size;
+    const EcsWorld* world = query->world;
+    const ComponentPool* driver = &world->pools[query->driver];
+    const EntityID* driver_owners = (EntityID*)driver->columns[OWNER_COLUMN];
+    const int skip_chunks = query->changed == COMPONENT_MASK(query->driver);
+    while (query->cursor < driver->count) {
+        if (skip_chunks && driver->versions[query->cursor / ECS_CHANGE_CHUNK_SIZE] <= query->since) {
+            query->cursor = ((query->cursor / ECS_CHANGE_CHUNK_SIZE) + 1) * ECS_CHANGE_CHUNK_SIZE;
+            continue;
+        }
 
-    s_components.rigid_bodies = (void*)buffer_offset;
-    buffer_offset += rigid_bodies_array_size;
+        const size_t driver_index = query->cursor++;
+        const EntityID entity_id = driver_owners[driver_index];
 
-    s_components.circle_colliders = (void*)buffer_offset;
-    buffer_offset += circle_colliders_array_size;
+        size_t index[COMPONENT_TYPE_COUNT] = { 0 };
+        int matched = 1;
+        for (size_t i = 0; i < COMPONENT_TYPE_COUNT && matched; ++i) {
+            if (! (query->mask & COMPONENT_MASK(i)))
+                continue;
 
-    for (size_t i = 0; i < s_max_components; ++i) {
-        s_components.positions[i].owner         = INVALID_ENTITY_ID;
-        s_components.displays[i].owner          = INVALID_ENTITY_ID;
-        s_components.rigid_bodies[i].owner      = INVALID_ENTITY_ID;
-        s_components.circle_colliders[i].owner  = INVALID_ENTITY_ID;
+            if (i == query->driver)
+                index[i] = driver_index;
+            else
+                matched = _get_pool_index(&world->pools[i], entity_id, &index[i]);
+        }
+
+        if (! matched || (query->changed != 0 && ! skip_chunks && ! _is_changed(world, query->changed, index, query->since)))
+            continue;
+
+        query->entity = entity_id;
+        memcpy(query->index, index, sizeof(index));
+        return 1;
     }
+
+    return 0;
+}
+
+EcsVersion ecs_change_tick(EcsWorld* world) {
+    return world->change_version++;
 }
 
-void ecs_free(void) {
-    if (s_components_buffer == NULL)
+void ecs_mark_changed(EcsWorld* world, const ComponentType type, const size_t begin, const size_t end) {
+    if (type >= COMPONENT_TYPE_COUNT)
         return;
 
-    pthread_mutex_destroy(&s_lock);
-    free(s_components_buffer);
+    ComponentPool* pool = &world->pools[type];
+    _mark_pool_changed(pool, begin, end < pool->count ? end : pool->count, world->change_version);
 }
 
-void ecs_lock_mutex(void) {
-    pthread_mutex_lock(&s_lock);
+EcsQuery ecs_query_changed(const EcsWorld* world, const ComponentMask mask, const ComponentMask changed, const EcsVersion since) {
+    EcsQuery query = ecs_query(world, mask);
+    query.changed = changed & query.mask;
+    query.since = since;
+
+    // nothing in the mask is watched, so nothing can have changed
+    if (query.changed == 0) {
+        query.mask = 0;
+        return query;
+    }
+
+    // with one watched pool, driving from it lets whole chunks be skipped
+    const ComponentType first = _first_component_type(query.changed);
+    if (query.changed == COMPONENT_MASK(first))
+        query.driver = first;
+
+    return query;
 }
 
-void ecs_unlock_mutex(void) {
-    pthread_mutex_unlock(&s_lock);
+size_t ecs_group(EcsWorld* world, const ComponentMask mask) {
+    if (_is_grouped(world, mask))
+        return world->pools[_first_component_type(mask)].group_count;
+
+    EcsQuery query = ecs_query(world, mask);
+    if (query.mask == 0)
+        return 0;
+
+    // every match gets swapped down to the next grouped slot in each pool.
+    // the slots below `grouped` are already claimed, so a match can only ever
+    // move down, and the driver's cursor never revisits what it has moved.
+    size_t grouped = 0;
+    while (ecs_query_next(&query)) {
+        for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+            if ((mask & COMPONENT_MASK(i)) && query.index[i] != grouped) {
+                _swap_pool_slots(&world->pools[i], query.index[i], grouped);
+                _mark_pool_changed(&world->pools[i], grouped, grouped + 1, world->change_version);
+                _mark_pool_changed(&world->pools[i], query.index[i], query.index[i] + 1, world->change_version);
+            }
+        }
+
+        grouped++;
+    }
+
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        if (mask & COMPONENT_MASK(i)) {
+            world->pools[i].group_mask = mask;
+            world->pools[i].group_count = grouped;
+        }
+    }
+
+    return grouped;
 }
 
-EntityID ecs_new_entity(void) {
-    const EntityID new_entity = s_next_entity++;
-    return new_entity;
+int ecs_save_snapshot(const EcsWorld* world, const char* path) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.endian_mark = SNAPSHOT_ENDIAN_MARK;
+    header.alignment = (uint64_t)sysconf(_SC_PAGESIZE);
+    header.next_index = world->next_index;
+    header.free_count = world->free_count;
+    header.live_count = world->live_count;
+    header.component_type_count = COMPONENT_TYPE_COUNT;
+    header.max_pool_columns = MAX_POOL_COLUMNS;
+    header.entity_index_bits = ECS_ENTITY_INDEX_BITS;
+
+    // lay every section out first so the header can go in with the data
+    size_t offset = _align_up(sizeof(header), header.alignment);
+    header.generations_offset = offset;
+    offset = _align_up(offset + sizeof(uint32_t)*world->next_index, header.alignment);
+    header.alive_offset = offset;
+    offset = _align_up(offset + sizeof(uint8_t)*world->next_index, header.alignment);
+    header.free_indices_offset = offset;
+    offset = _align_up(offset + sizeof(uint32_t)*world->free_count, header.alignment);
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        const ComponentPool* pool = &world->pools[type];
+        SnapshotPool* section = &header.pools[type];
+        section->count = pool->count;
+
+        for (size_t col = 0; col < MAX_POOL_COLUMNS && s_pool_column_sizes[type][col] != 0; ++col) {
+            section->column_sizes[col] = s_pool_column_sizes[type][col];
+            section->column_offsets[col] = offset;
+            offset = _align_up(offset + section->column_sizes[col]*pool->count, header.alignment);
+        }
+    }
+
+    header.file_size = offset;
+
+    // written next to the destination, synced and only then renamed over it,
+    // so a crash part way through never leaves a torn checkpoint behind
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        fprintf(stderr, "ERROR: snapshot path %s is too long\n", path);
+        return 0;
+    }
+
+    const int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: failed to open snapshot file %s (%s)\n", temp_path, strerror(errno));
+        return 0;
+    }
+
+    int ok = _write_snapshot_section(fd, 0, &header, sizeof(header))
+        && _write_snapshot_section(fd, header.generations_offset, world->generations, sizeof(uint32_t)*world->next_index)
+        && _write_snapshot_section(fd, header.alive_offset, world->alive, sizeof(uint8_t)*world->next_index)
+        && _write_snapshot_section(fd, header.free_indices_offset, world->free_indices, sizeof(uint32_t)*world->free_count);
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT && ok; ++type) {
+        const ComponentPool* pool = &world->pools[type];
+        for (size_t col = 0; col < pool->column_count && ok; ++col)
+            ok = _write_snapshot_section(fd, header.pools[type].column_offsets[col], pool->columns[col], pool->column_sizes[col]*pool->count);
+    }
+
+    // pad out the last section so a loader mapping whole pages never runs off the file
+    if (ok && ftruncate(fd, (off_t)header.file_size) != 0) {
+        fprintf(stderr, "ERROR: failed to size snapshot file %s (%s)\n", temp_path, strerror(errno));
+        ok = 0;
+    }
+
+    // without this the rename can reach the disk before the data does
+    if (ok && fsync(fd) != 0) {
+        fprintf(stderr, "ERROR: failed to sync snapshot file %s (%s)\n", temp_path, strerror(errno));
+        ok = 0;
+    }
+
+    if (close(fd) != 0)
+        ok = 0;
+
+    if (ok && rename(temp_path, path) != 0) {
+        fprintf(stderr, "ERROR: failed to move snapshot into place at %s (%s)\n", path, strerror(errno));
+        ok = 0;
+    }
+
+    if (! ok)
+        unlink(temp_path);
+
+    return ok;
 }
 
-PositionComponent* ecs_new_position_component(const EntityID entity_id) {
-    if (s_components.position_count == s_max_components)
+EcsWorld* ecs_load_snapshot(const char* path, const EcsConfig* config) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: failed to open snapshot file %s (%s)\n", path, strerror(errno));
         return NULL;
+    }
 
-    PositionComponent* c = _get_free_component(s_components.positions, sizeof(PositionComponent));
-    c->owner = entity_id;
-    s_components.position_count++;
+    struct stat file_stat;
+    SnapshotHeader header;
+    if (fstat(fd, &file_stat) != 0 || ! _load_snapshot_section(fd, 0, &header, sizeof(header))
+        || ! _check_snapshot_header(&header, (size_t)file_stat.st_size)) {
+        fprintf(stderr, "ERROR: %s isn't a snapshot this build can load\n", path);
+        close(fd);
+        return NULL;
+    }
 
-    return c;
-}
+    // the pools have to be able to hold everything in the file
+    EcsConfig world_config = {
+        .reserved_components    = ECS_DEFAULT_RESERVED_COMPONENTS,
+        .huge_pages             = 0,
+    };
+    if (config != NULL)
+        world_config = *config;
+
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        if (header.pools[type].count > world_config.reserved_components)
+            world_config.reserved_components = header.pools[type].count;
+    }
 
-DisplayComponent* ecs_new_display_component(const EntityID entity_id) {
-    if (s_components.display_count == s_max_components)
+    EcsWorld* world = ecs_world_create(&world_config);
+    if (world == NULL || ! _grow_entities(world, header.next_index)) {
+        ecs_world_destroy(world);
+        close(fd);
         return NULL;
+    }
 
-    DisplayComponent* c = _get_free_component(s_components.displays, sizeof(DisplayComponent));
-    c->owner = entity_id;
-    s_components.display_count++;
+    int ok = _load_snapshot_section(fd, header.generations_offset, world->generations, sizeof(uint32_t)*header.next_index)
+        && _load_snapshot_section(fd, header.alive_offset, world->alive, sizeof(uint8_t)*header.next_index)
+        && _load_snapshot_section(fd, header.free_indices_offset, world->free_indices, sizeof(uint32_t)*header.free_count);
 
-    return c;
-}
+    world->next_index = header.next_index;
+    world->free_count = header.free_count;
+    world->live_count = header.live_count;
+
+    // the entity arrays are trusted from here on, so a bad free list would
+    // turn into writes past the end of them. seen marks indices already used,
+    // first by the free list then by each pool's owners in turn
+    uint8_t* seen = calloc(header.next_index, sizeof(uint8_t));
+    ok = ok && seen != NULL && _check_snapshot_entities(world, seen);
+
+    // columns are mapped copy on write, so loading costs a few syscalls no
+    // matter how big the world is and pages come in as they're first used.
+    // a file written with a different page size is read in instead.
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const int mappable = header.alignment % page_size == 0;
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT && ok; ++type) {
+        ComponentPool* pool = &world->pools[type];
+        const size_t count = header.pools[type].count;
+        if (count == 0)
+            continue;
+
+        for (size_t col = 0; col < pool->column_count && ok; ++col) {
+            const size_t offset = header.pools[type].column_offsets[col];
+            const size_t size = pool->column_sizes[col]*count;
+            if (mappable)
+                ok = vmem_map_file(&pool->ranges[col], fd, offset, size);
+            else
+                ok = vmem_commit(&pool->ranges[col], size) && _load_snapshot_section(fd, offset, pool->columns[col], size);
+        }
+
+        ok = ok && pool->column_count > 0 && _grow_versions(pool, count);
+        if (! ok)
+            break;
 
-RigidBodyComponent* ecs_new_rigid_body_component(const EntityID entity_id) {
-    if (s_components.rigid_body_count == s_max_components)
+        // everything loaded counts as written at the first version
+        pool->count = count;
+        pool->capacity = count;
+        _mark_pool_changed(pool, 0, count, world->change_version);
+
+        // sparse arrays aren't stored, they're cheaper to rebuild than to
+        // read. every owner has to be a live entity, at most once per pool
+        memset(seen, 0, sizeof(uint8_t)*world->next_index);
+        const EntityID* owners = (EntityID*)pool->columns[OWNER_COLUMN];
+        for (size_t i = 0; i < count && ok; ++i) {
+            const size_t index = ECS_ENTITY_INDEX(owners[i]);
+            ok = ecs_is_alive(world, owners[i]) && ! seen[index];
+            if (ok) {
+                seen[index] = 1;
+                pool->sparse[index] = i;
+            }
+        }
+    }
+
+    close(fd);
+    free(seen);
+
+    if (! ok) {
+        fprintf(stderr, "ERROR: failed to load snapshot %s\n", path);
+        ecs_world_destroy(world);
         return NULL;
+    }
+
+    return world;
+}
 
-    RigidBodyComponent* c = _get_free_component(s_components.rigid_bodies, sizeof(RigidBodyComponent));
-    c->owner = entity_id;
-    s_components.rigid_body_count++;
+static int _new_component(EcsWorld* world, ComponentType type, EntityID entity_id, size_t* o_index) {
+    if (! ecs_is_alive(world, entity_id))
+        return 0;
 
-    return c;
+    // an entity only ever owns one of each component, so this is an overwrite
+    if (_get_component_index(world, type, entity_id, o_index)) {
+        _mark_pool_changed(&world->pools[type], *o_index, *o_index + 1, world->change_version);
+        return 1;
+    }
+
+    ComponentPool* pool = &world->pools[type];
+    if (pool->count == pool->capacity && ! _grow_pool(world, pool, pool->count + 1))
+        return 0;
+
+    // the pool is kept packed, so the next free slot is always at the end
+    const size_t index = pool->count++;
+    pool->group_mask = 0;
+    _mark_pool_changed(pool, index, index + 1, world->change_version);
+    ((EntityID*)pool->columns[OWNER_COLUMN])[index] = entity_id;
+    pool->sparse[ECS_ENTITY_INDEX(entity_id)] = index;
+
+    *o_index = index;
+    return 1;
 }
 
-CircleColliderComponent* ecs_new_circle_collider_component(const EntityID entity_id) {
-    if (s_components.circle_collider_count == s_max_components)
-        return NULL;
+static int _get_component_index(const EcsWorld* world, ComponentType type, EntityID entity_id, size_t* o_index) {
+    if (entity_id == INVALID_ENTITY_ID || ECS_ENTITY_INDEX(entity_id) >= world->entity_capacity)
+        return 0;
 
-    CircleColliderComponent* c = _get_free_component(s_components.circle_colliders, sizeof(CircleColliderComponent));
-    c->owner = entity_id;
-    s_components.circle_collider_count++;
+    return _get_pool_index(&world->pools[type], entity_id, o_index);
+}
 
-    return c;
+static int _get_pool_index(const ComponentPool* pool, EntityID entity_id, size_t* o_index) {
+    const size_t index = pool->sparse[ECS_ENTITY_INDEX(entity_id)];
+    if (index >= pool->count)
+        return 0;
+
+    const EntityID* owners = (EntityID*)pool->columns[OWNER_COLUMN];
+    if (owners[index] != entity_id)
+        return 0;
+
+    *o_index = index;
+    return 1;
 }
 
-PositionComponent* ecs_get_position_component(const EntityID entity_id) {
-    return _get_component(s_components.positions, sizeof(PositionComponent), entity_id);
+static int _remove_component(EcsWorld* world, ComponentType type, EntityID entity_id) {
+    size_t index;
+    if (! _get_component_index(world, type, entity_id, &index))
+        return 0;
+
+    // swap and pop: the last component moves into the hole so the pool stays packed
+    ComponentPool* pool = &world->pools[type];
+    const size_t last = pool->count - 1;
+    if (index != last) {
+        for (size_t col = 0; col < pool->column_count; ++col) {
+            const size_t size = pool->column_sizes[col];
+            memcpy(pool->columns[col] + (index * size), pool->columns[col] + (last * size), size);
+        }
+
+        const EntityID moved = ((EntityID*)pool->columns[OWNER_COLUMN])[index];
+        pool->sparse[ECS_ENTITY_INDEX(moved)] = index;
+        _mark_pool_changed(pool, index, index + 1, world->change_version);
+    }
+
+    pool->count--;
+    pool->group_mask = 0;
+
+    return 1;
 }
 
-DisplayComponent* ecs_get_display_component(const EntityID entity_id) {
-    return _get_component(s_components.displays, sizeof(DisplayComponent), entity_id);
+static void _swap_pool_slots(ComponentPool* pool, size_t a, size_t b) {
+    for (size_t col = 0; col < pool->column_count; ++col) {
+        const size_t size = pool->column_sizes[col];
+        unsigned char* slot_a = pool->columns[col] + (a * size);
+        unsigned char* slot_b = pool->columns[col] + (b * size);
+
+        unsigned char tmp[MAX_COLUMN_ELEMENT_SIZE];
+        memcpy(tmp, slot_a, size);
+        memcpy(slot_a, slot_b, size);
+        memcpy(slot_b, tmp, size);
+    }
+
+    const EntityID* owners = (EntityID*)pool->columns[OWNER_COLUMN];
+    pool->sparse[ECS_ENTITY_INDEX(owners[a])] = a;
+    pool->sparse[ECS_ENTITY_INDEX(owners[b])] = b;
 }
 
-RigidBodyComponent* ecs_get_rigid_body_component(const EntityID entity_id) {
-    return _get_component(s_components.rigid_bodies, sizeof(RigidBodyComponent), entity_id);
+static void _mark_pool_changed(ComponentPool* pool, size_t begin, size_t end, EcsVersion version) {
+    if (begin >= end)
+        return;
+
+    const size_t last = (end - 1) / ECS_CHANGE_CHUNK_SIZE;
+    for (size_t chunk = begin / ECS_CHANGE_CHUNK_SIZE; chunk <= last; ++chunk)
+        pool->versions[chunk] = version;
+}
+
+static int _is_changed(const EcsWorld* world, ComponentMask changed, const size_t* index, EcsVersion since) {
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        if ((changed & COMPONENT_MASK(i)) && world->pools[i].versions[index[i] / ECS_CHANGE_CHUNK_SIZE] > since)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int _is_grouped(const EcsWorld* world, ComponentMask mask) {
+    if (_first_component_type(mask) == COMPONENT_TYPE_COUNT)
+        return 0;
+
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        if ((mask & COMPONENT_MASK(i)) && world->pools[i].group_mask != mask)
+            return 0;
+    }
+
+    return 1;
+}
+
+static ComponentType _first_component_type(ComponentMask mask) {
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        if (mask & COMPONENT_MASK(i))
+            return i;
+    }
+
+    return COMPONENT_TYPE_COUNT;
+}
+
+static int _grow_pool(EcsWorld* world, ComponentPool* pool, size_t min_capacity) {
+    if (pool->column_count == 0 || min_capacity > world->reserved_components)
+        return 0;
+
+    size_t new_capacity = pool->capacity > 0 ? pool->capacity : INITIAL_POOL_CAPACITY;
+    while (new_capacity < min_capacity)
+        new_capacity *= 2;
+
+    if (new_capacity > world->reserved_components)
+        new_capacity = world->reserved_components;
+
+    // committing is page granular, so a column may end up with more room than
+    // asked for. the capacity only moves once every column has grown.
+    for (size_t col = 0; col < pool->column_count; ++col) {
+        if (! vmem_commit(&pool->ranges[col], pool->column_sizes[col]*new_capacity))
+            return 0;
+    }
+
+    if (! _grow_versions(pool, new_capacity))
+        return 0;
+
+    pool->capacity = new_capacity;
+    return 1;
 }
 
-CircleColliderComponent* ecs_get_circle_collider_component(const EntityID entity_id) {
-    return _get_component(s_components.circle_colliders, sizeof(CircleColliderComponent), entity_id);
+static int _grow_versions(ComponentPool* pool, size_t capacity) {
+    const size_t old_chunks = (pool->capacity + ECS_CHANGE_CHUNK_SIZE - 1) / ECS_CHANGE_CHUNK_SIZE;
+    const size_t new_chunks = (capacity + ECS_CHANGE_CHUNK_SIZE - 1) / ECS_CHANGE_CHUNK_SIZE;
+    if (new_chunks <= old_chunks)
+        return 1;
+
+    EcsVersion* versions = realloc(pool->versions, sizeof(EcsVersion)*new_chunks);
+    if (versions == NULL)
+        return 0;
+
+    memset(versions + old_chunks, 0, sizeof(EcsVersion)*(new_chunks - old_chunks));
+    pool->versions = versions;
+    return 1;
 }
 
-void ecs_get_position_component_array(PositionComponent** o_array, size_t* o_size) {
-    *o_array = s_components.positions;
-    *o_size = s_components.position_count;
+static int _grow_entities(EcsWorld* world, size_t min_capacity) {
+    size_t new_capacity = world->entity_capacity > 0 ? world->entity_capacity : INITIAL_ENTITY_CAPACITY;
+    while (new_capacity < min_capacity)
+        new_capacity *= 2;
+
+    const size_t added = new_capacity - world->entity_capacity;
+
+    // realloc leaves the old block alone on failure, so each array is only
+    // swapped in once it has grown, and the capacity only moves once they all have
+    for (size_t i = 0; i < COMPONENT_TYPE_COUNT; ++i) {
+        uint32_t* sparse = realloc(world->pools[i].sparse, sizeof(uint32_t)*new_capacity);
+        if (sparse == NULL)
+            return 0;
+
+        memset(sparse + world->entity_capacity, 0, sizeof(uint32_t)*added);
+        world->pools[i].sparse = sparse;
+    }
+
+    uint32_t* generations = realloc(world->generations, sizeof(uint32_t)*new_capacity);
+    if (generations == NULL)
+        return 0;
+    memset(generations + world->entity_capacity, 0, sizeof(uint32_t)*added);
+    world->generations = generations;
+
+    uint8_t* alive = realloc(world->alive, sizeof(uint8_t)*new_capacity);
+    if (alive == NULL)
+        return 0;
+    memset(alive + world->entity_capacity, 0, sizeof(uint8_t)*added);
+    world->alive = alive;
+
+    uint32_t* free_indices = realloc(world->free_indices, sizeof(uint32_t)*new_capacity);
+    if (free_indices == NULL)
+        return 0;
+    world->free_indices = free_indices;
+
+    world->entity_capacity = new_capacity;
+    return 1;
 }
 
-void ecs_get_display_component_array(DisplayComponent** o_array, size_t* o_size) {
-    *o_array = s_components.displays;
-    *o_size = s_components.display_count;
+static int _check_snapshot_header(const SnapshotHeader* header, const size_t file_size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->endian_mark != SNAPSHOT_ENDIAN_MARK
+        || header->component_type_count != COMPONENT_TYPE_COUNT
+        || header->max_pool_columns != MAX_POOL_COLUMNS
+        || header->entity_index_bits != ECS_ENTITY_INDEX_BITS
+        || header->alignment == 0
+        || (header->alignment & (header->alignment - 1)) != 0
+        || header->file_size != file_size)
+        return 0;
+
+    if (header->next_index == 0 || header->next_index > ECS_ENTITY_INDEX_MASK + 1
+        || header->free_count > header->next_index || header->live_count > header->next_index)
+        return 0;
+
+    if (header->generations_offset + sizeof(uint32_t)*header->next_index > file_size
+        || header->alive_offset + sizeof(uint8_t)*header->next_index > file_size
+        || header->free_indices_offset + sizeof(uint32_t)*header->free_count > file_size)
+        return 0;
+
+    // every column has to match this build's layout and sit on a section
+    // boundary wholly inside the file
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        const SnapshotPool* pool = &header->pools[type];
+        for (size_t col = 0; col < MAX_POOL_COLUMNS; ++col) {
+            if (pool->column_sizes[col] != s_pool_column_sizes[type][col])
+                return 0;
+
+            if (pool->column_sizes[col] == 0)
+                continue;
+
+            if (pool->column_offsets[col] % header->alignment != 0
+                || pool->column_offsets[col] + _align_up(pool->column_sizes[col]*pool->count, header->alignment) > file_size)
+                return 0;
+        }
+    }
+
+    return 1;
 }
-void ecs_get_rigid_body_component_array(RigidBodyComponent** o_array, size_t* o_size) {
-    *o_array = s_components.rigid_bodies;
-    *o_size = s_components.rigid_body_count;
+
+// every index below next_index, bar 0, has to be either alive or on the free
+// list exactly once, and generations have to fit in a handle. seen comes in
+// zeroed with room for next_index entries
+static int _check_snapshot_entities(const EcsWorld* world, uint8_t* seen) {
+    if (world->alive[0] || world->live_count + world->free_count != world->next_index - 1)
+        return 0;
+
+    for (size_t i = 0; i < world->free_count; ++i) {
+        const size_t index = world->free_indices[i];
+        if (index == 0 || index >= world->next_index || world->alive[index] || seen[index])
+            return 0;
+
+        seen[index] = 1;
+    }
+
+    size_t live_count = 0;
+    for (size_t index = 1; index < world->next_index; ++index) {
+        if (world->generations[index] > ECS_ENTITY_GENERATION_MASK || world->alive[index] > 1)
+            return 0;
+
+        live_count += world->alive[index];
+    }
+
+    return live_count == world->live_count;
 }
-void ecs_get_circle_collider_component_array(CircleColliderComponent** o_array, size_t* o_size) {
-    *o_array = s_components.circle_colliders;
-    *o_size = s_components.circle_collider_count;
+
+static int _load_snapshot_section(const int fd, const size_t offset, void* data, const size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t got = pread(fd, (unsigned char*)data + done, size - done, (off_t)(offset + done));
+        if (got == -1 && errno == EINTR)
+            continue;
+
+        if (got <= 0)
+            return 0;
+
+        done += (size_t)got;
+    }
+
+    return 1;
 }
 
-static void* _get_component(void* component_array, size_t stride, EntityID entity_id) {
-    const unsigned char* start_addr = component_array;
+static int _write_snapshot_section(const int fd, const size_t offset, const void* data, const size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t wrote = pwrite(fd, (const unsigned char*)data + done, size - done, (off_t)(offset + done));
+        if (wrote == -1 && errno == EINTR)
+            continue;
 
-    for (size_t i = 0; i < s_max_components; ++i) {
-        const unsigned char* c = start_addr + (i * stride);
-        const EntityID* id = (EntityID*)c;
-        if (*id == entity_id)
-            return (void*)c;
+        if (wrote <= 0) {
+            fprintf(stderr, "ERROR: failed to write snapshot (%s)\n", strerror(errno));
+            return 0;
+        }
+
+        done += (size_t)wrote;
     }
 
-    return NULL;
+    return 1;
 }
 
-static void* _get_free_component(void* component_array, size_t stride) {
-    return _get_component(component_array, stride, INVALID_ENTITY_ID);
+static size_t _align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
 }
 
+#ifdef ECS_ENABLE_LOCK_STATS
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+#endif
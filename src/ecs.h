@@ -3,60 +3,287 @@
 
 #include "raylib.h"
 #include <stdlib.h>
+#include <stdint.h>
 
-typedef size_t EntityID;
+#include "lock_stats.h"
+
+// the low bits index the entity's slot and the high bits hold the slot's
+// generation, which is bumped every time the slot is freed. a handle kept
+// past its entity's destruction therefore never matches the slot again, even
+// once the slot has been recycled, until the generation wraps around.
+//
+// handles are 32 bits so every pool's owner column and sparse array cost 4
+// bytes per entity rather than 8. the default split allows 16M entities and
+// 256 generations per slot; builds that need more entities can move the
+// split with -DECS_ENTITY_INDEX_BITS=N, at the cost of generations.
+typedef uint32_t EntityID;
 #define INVALID_ENTITY_ID 0
-#define COMPONENT_BASE EntityID owner;
+
+#ifndef ECS_ENTITY_INDEX_BITS
+#define ECS_ENTITY_INDEX_BITS 24
+#endif
+
+#define ECS_ENTITY_GENERATION_BITS (32 - ECS_ENTITY_INDEX_BITS)
+#define ECS_ENTITY_INDEX_MASK (((EntityID)1 << ECS_ENTITY_INDEX_BITS) - 1)
+#define ECS_ENTITY_GENERATION_MASK (((EntityID)1 << ECS_ENTITY_GENERATION_BITS) - 1)
+#define ECS_ENTITY_INDEX(id) ((size_t)((id) & ECS_ENTITY_INDEX_MASK))
+#define ECS_ENTITY_GENERATION(id) ((uint32_t)((id) >> ECS_ENTITY_INDEX_BITS))
+#define ECS_MAX_ENTITIES ((size_t)ECS_ENTITY_INDEX_MASK)
+
+_Static_assert(sizeof(EntityID) == 4, "entity handles are meant to be 32 bits");
+_Static_assert(ECS_ENTITY_INDEX_BITS >= 16 && ECS_ENTITY_INDEX_BITS <= 30, "need room for both indices and generations");
+
+// every pool column starts on its own cache line
+#define ECS_COLUMN_ALIGNMENT 64
+
+// change tracking. every write stamps the chunk of ECS_CHANGE_CHUNK_SIZE slots
+// it lands in with the world's current change version, so a consumer that
+// remembers the version it last caught up at can skip whole chunks nobody
+// has written to since.
+typedef uint64_t EcsVersion;
+#define ECS_CHANGE_CHUNK_SIZE 64
 
 typedef struct {
     float x;
     float y;
 } Vec2;
 
+// components are plain values used to move data in and out of the pools. the
+// pools themselves store each field in a separate column, see the *Columns
+// views below.
 typedef struct {
-    COMPONENT_BASE
     Vec2    pos;
 } PositionComponent;
 
 typedef struct {
-    COMPONENT_BASE
     float   radius;
     Color   color;
 } DisplayComponent;
 
 typedef struct {
-    COMPONENT_BASE
     float   mass;
     Vec2    velocity;
 } RigidBodyComponent;
 
 typedef struct {
-    COMPONENT_BASE
     float   radius;
 } CircleColliderComponent;
 
-void ecs_init(const size_t max_components);
-void ecs_free(void);
+// components are copied in and out by value all the time, so none of them may
+// pick up padding
+_Static_assert(sizeof(PositionComponent) == 8 && _Alignof(PositionComponent) == 4, "PositionComponent isn't packed");
+_Static_assert(sizeof(DisplayComponent) == 8 && _Alignof(DisplayComponent) == 4, "DisplayComponent isn't packed");
+_Static_assert(sizeof(RigidBodyComponent) == 12 && _Alignof(RigidBodyComponent) == 4, "RigidBodyComponent isn't packed");
+_Static_assert(sizeof(CircleColliderComponent) == 4 && _Alignof(CircleColliderComponent) == 4, "CircleColliderComponent isn't packed");
 
-void ecs_lock_mutex(void);
-void ecs_unlock_mutex(void);
+// column views over a pool. every column holds `count` elements, starts on an
+// ECS_COLUMN_ALIGNMENT boundary, and element i of each column belongs to the
+// same component. views are invalidated by anything that adds or removes
+// components, as removal moves the last component into the freed slot.
+typedef struct {
+    const EntityID* owners;
+    float*          x;
+    float*          y;
+    size_t          count;
+} PositionColumns;
 
-EntityID ecs_new_entity(void);
+typedef struct {
+    const EntityID* owners;
+    float*          radius;
+    Color*          color;
+    size_t          count;
+} DisplayColumns;
 
-PositionComponent* ecs_new_position_component(const EntityID entity_id);
-DisplayComponent* ecs_new_display_component(const EntityID entity_id);
-RigidBodyComponent* ecs_new_rigid_body_component(const EntityID entity_id);
-CircleColliderComponent* ecs_new_circle_collider_component(const EntityID entity_id);
+typedef struct {
+    const EntityID* owners;
+    float*          mass;
+    float*          velocity_x;
+    float*          velocity_y;
+    size_t          count;
+} RigidBodyColumns;
 
-PositionComponent* ecs_get_position_component(const EntityID entity_id);
-DisplayComponent* ecs_get_display_component(const EntityID entity_id);
-RigidBodyComponent* ecs_get_rigid_body_component(const EntityID entity_id);
-CircleColliderComponent* ecs_get_circle_collider_component(const EntityID entity_id);
+typedef struct {
+    const EntityID* owners;
+    float*          radius;
+    size_t          count;
+} CircleColliderColumns;
 
-void ecs_get_position_component_array(PositionComponent** o_array, size_t* o_size);
-void ecs_get_display_component_array(DisplayComponent** o_array, size_t* o_size);
-void ecs_get_rigid_body_component_array(RigidBodyComponent** o_array, size_t* o_size);
-void ecs_get_circle_collider_component_array(CircleColliderComponent** o_array, size_t* o_size);
+typedef enum {
+    COMPONENT_TYPE_POSITION = 0,
+    COMPONENT_TYPE_DISPLAY,
+    COMPONENT_TYPE_RIGID_BODY,
+    COMPONENT_TYPE_CIRCLE_COLLIDER,
+    COMPONENT_TYPE_COUNT,
+} ComponentType;
 
-#endif // #ifndef ECS_H
+// a world owns its entities, pools and lock outright. worlds share nothing, so
+// separate worlds can be stepped on separate threads without any contention.
+// every function taking a world expects the caller to hold its lock whenever
+// another thread could be using it too.
+typedef struct EcsWorld EcsWorld;
+
+typedef uint32_t ComponentMask;
+#define COMPONENT_MASK(type)        (1u << (type))
+#define COMPONENT_POSITION          COMPONENT_MASK(COMPONENT_TYPE_POSITION)
+#define COMPONENT_DISPLAY           COMPONENT_MASK(COMPONENT_TYPE_DISPLAY)
+#define COMPONENT_RIGID_BODY        COMPONENT_MASK(COMPONENT_TYPE_RIGID_BODY)
+#define COMPONENT_CIRCLE_COLLIDER   COMPONENT_MASK(COMPONENT_TYPE_CIRCLE_COLLIDER)
+
+// iterates every entity owning all of the components in a mask. the smallest
+// pool in the mask drives the iteration and the others are resolved through
+// their sparse index, so each match costs a handful of array reads. `index`
+// holds the slot of each matched component in its pool's columns and is left
+// at 0 for components outside the mask.
+typedef struct {
+    EntityID        entity;
+    size_t          index[COMPONENT_TYPE_COUNT];
+
+    // iteration state, not to be touched by callers
+    const EcsWorld* world;
+    ComponentMask   mask;
+    ComponentMask   changed;
+    EcsVersion      since;
+    ComponentType   driver;
+    size_t          cursor;
+} EcsQuery;
+
+// pools grow on demand inside address space reserved up front, so the only
+// hard limit is reserved_components per component type. large worlds can ask
+// for transparent huge pages to cut down on tlb misses.
+#define ECS_DEFAULT_RESERVED_COMPONENTS ((size_t)1 << 24)
+
+typedef struct {
+    size_t  reserved_components;
+    int     huge_pages;
+} EcsConfig;
+
+// a NULL config uses the defaults. returns NULL on failure
+EcsWorld* ecs_world_create(const EcsConfig* config);
+void ecs_world_destroy(EcsWorld* world);
+
+// with ECS_ENABLE_LOCK_STATS every acquisition records how long it waited for
+// the lock and how long it then held it, against the caller's file and line
+#define ecs_lock_mutex(world) ecs_lock_mutex_at((world), LOCK_STATS_SITE)
+void ecs_lock_mutex_at(EcsWorld* world, const char* site);
+void ecs_unlock_mutex(EcsWorld* world);
+
+EntityID ecs_new_entity(EcsWorld* world);
+
+// removes all of the entity's components and recycles its slot. returns 0 if
+// the handle is stale
+int ecs_destroy_entity(EcsWorld* world, const EntityID entity_id);
+int ecs_is_alive(const EcsWorld* world, const EntityID entity_id);
+size_t ecs_entity_count(const EcsWorld* world);
 
+// what a world's memory goes on. bytes_per_entity figures are what one more
+// entity costs in steady state: a pool's columns, owner included, its sparse
+// entry and its share of a change version. committed_bytes is what's backed
+// by memory right now, spare capacity included.
+typedef struct {
+    size_t  count;
+    size_t  capacity;
+    double  bytes_per_entity;
+    size_t  committed_bytes;
+} EcsPoolMemory;
+
+typedef struct {
+    EcsPoolMemory   pools[COMPONENT_TYPE_COUNT];
+    size_t          entity_count;
+    size_t          entity_capacity;
+    double          bytes_per_entity;   // generation, alive flag and free list entry
+    size_t          committed_bytes;    // the entity arrays and every pool
+} EcsMemoryStats;
+
+void ecs_get_memory_stats(const EcsWorld* world, EcsMemoryStats* o_stats);
+
+// adding a component the entity already owns overwrites it. return 0 on failure
+int ecs_new_position_component(EcsWorld* world, const EntityID entity_id, const PositionComponent* component);
+int ecs_new_display_component(EcsWorld* world, const EntityID entity_id, const DisplayComponent* component);
+int ecs_new_rigid_body_component(EcsWorld* world, const EntityID entity_id, const RigidBodyComponent* component);
+int ecs_new_circle_collider_component(EcsWorld* world, const EntityID entity_id, const CircleColliderComponent* component);
+
+// return 0 if the entity doesn't own the component
+int ecs_get_position_component(const EcsWorld* world, const EntityID entity_id, PositionComponent* o_component);
+int ecs_get_display_component(const EcsWorld* world, const EntityID entity_id, DisplayComponent* o_component);
+int ecs_get_rigid_body_component(const EcsWorld* world, const EntityID entity_id, RigidBodyComponent* o_component);
+int ecs_get_circle_collider_component(const EcsWorld* world, const EntityID entity_id, CircleColliderComponent* o_component);
+
+int ecs_set_position_component(EcsWorld* world, const EntityID entity_id, const PositionComponent* component);
+int ecs_set_display_component(EcsWorld* world, const EntityID entity_id, const DisplayComponent* component);
+int ecs_set_rigid_body_component(EcsWorld* world, const EntityID entity_id, const RigidBodyComponent* component);
+int ecs_set_circle_collider_component(EcsWorld* world, const EntityID entity_id, const CircleColliderComponent* component);
+
+// return 0 if the entity doesn't own the component
+int ecs_remove_position_component(EcsWorld* world, const EntityID entity_id);
+int ecs_remove_display_component(EcsWorld* world, const EntityID entity_id);
+int ecs_remove_rigid_body_component(EcsWorld* world, const EntityID entity_id);
+int ecs_remove_circle_collider_component(EcsWorld* world, const EntityID entity_id);
+int ecs_remove_component(EcsWorld* world, const EntityID entity_id, const ComponentType type);
+
+int ecs_has_component(const EcsWorld* world, const EntityID entity_id, const ComponentType type);
+
+void ecs_get_position_columns(EcsWorld* world, PositionColumns* o_columns);
+void ecs_get_display_columns(EcsWorld* world, DisplayColumns* o_columns);
+void ecs_get_rigid_body_columns(EcsWorld* world, RigidBodyColumns* o_columns);
+void ecs_get_circle_collider_columns(EcsWorld* world, CircleColliderColumns* o_columns);
+
+// views over the slots handed to a spawned batch. element i of every column
+// belongs to ids[i], and views of components the batch didn't ask for are
+// empty.
+typedef struct {
+    const EntityID*         ids;
+    size_t                  count;
+    PositionColumns         position;
+    DisplayColumns          display;
+    RigidBodyColumns        rigid_body;
+    CircleColliderColumns   circle_collider;
+} EcsSpawnBatch;
+
+typedef void (*EcsSpawnInit)(void* context, const EcsSpawnBatch* batch);
+
+// creates count entities which each own every component in mask. the new
+// components take one contiguous run of slots at the end of each pool, start
+// zeroed and are then handed to init, if there is one, to fill in bulk. the new
+// ids are written to o_ids when it isn't NULL. returns 0, having created
+// nothing, if the batch doesn't fit
+int ecs_spawn_batch(EcsWorld* world, const size_t count, const ComponentMask mask, EcsSpawnInit init, void* context, EntityID* o_ids);
+
+EcsQuery ecs_query(const EcsWorld* world, const ComponentMask mask);
+int ecs_query_next(EcsQuery* query);
+
+// returns the current change version and starts a new one, so everything
+// written afterwards compares newer. consumers call it once they've caught up
+// and pass the result to their next changed query.
+EcsVersion ecs_change_tick(EcsWorld* world);
+
+// column views write behind the world's back, so whoever writes through them
+// marks the slots [begin, end) it wrote. setters, spawning and anything that
+// moves components around mark their slots themselves. ranges marked at the
+// same time from different threads must not share a chunk
+void ecs_mark_changed(EcsWorld* world, const ComponentType type, const size_t begin, const size_t end);
+
+// like ecs_query, but only matches entities where at least one component in
+// `changed` may have been written after `since`. tracking is per chunk, so
+// untouched neighbours of a written slot match too, and removed components
+// aren't reported. with a single changed type, unchanged chunks of that pool
+// are skipped without looking at their entities
+EcsQuery ecs_query_changed(const EcsWorld* world, const ComponentMask mask, const ComponentMask changed, const EcsVersion since);
+
+// checkpoints. a snapshot holds every entity and component in a world, and
+// loading one builds a fresh world that carries on exactly where the saved one
+// left off, entity ids included. pool columns are mapped straight out of the
+// file rather than read, so loading stays cheap however big the world is.
+// config is used as for ecs_world_create, with the reservation raised to fit
+// the file if needed. both return 0/NULL on failure
+int ecs_save_snapshot(const EcsWorld* world, const char* path);
+EcsWorld* ecs_load_snapshot(const char* path, const EcsConfig* config);
+
+// reorders the pools in `mask` so the entities owning all of them sit in the
+// first N slots of each pool, in the same order, and returns N. columns of
+// those pools can then be streamed in lockstep over [0, N). cheap when the
+// pools are already grouped. overlapping groups will keep reshuffling each
+// other, so a pool should only ever be grouped with one mask. grouping moves
+// components around, so it counts as writing to every pool in mask.
+size_t ecs_group(EcsWorld* world, const ComponentMask mask);
+
+#endif // #ifndef ECS_H
@@ -2,155 +2,280 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+// four levels of 64 slots. level n slots are 64^n ticks wide, so together
+// they reach 2^24ms (about 4.6 hours) ahead. timers further out than that
+// park in the last level and get re-filed each time they cascade.
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1u << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_RANGE (1ull << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+#define NIL_NODE UINT32_MAX
+#define INITIAL_NODE_CAPACITY 64
 
 typedef struct {
     TimerCallback   callback;
     void*           args;
-} CallbackInfo;
-
-#define MAX_TIMERS 50
-#define PRETTY_FORMAT_BUF_SIZE 30
-
-static int s_timer_in_use[MAX_TIMERS];
-static struct timeval s_start_times[MAX_TIMERS];
-static char s_pretty_format_buf[PRETTY_FORMAT_BUF_SIZE];
-
-static CallbackInfo s_timer_callbacks[MAX_TIMERS];
-static uint64_t s_timer_durations[MAX_TIMERS];
+    uint64_t        expires_ms;
+    uint64_t        period_ms;      // 0 for one shot timers
+    uint32_t        prev;
+    uint32_t        next;
+    uint32_t        generation;
+    uint8_t         level;
+    uint8_t         slot;
+    uint8_t         in_use;
+    uint8_t         linked;         // clear while a one shot's callback runs
+} TimerNode;
+
+// nodes are addressed by index rather than pointer so the pool can grow
+static TimerNode*   s_nodes             = NULL;
+static uint32_t     s_node_capacity     = 0;
+static uint32_t     s_free_head         = NIL_NODE;
+static size_t       s_pending_count     = 0;
+
+static uint32_t     s_wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t     s_current_ms        = 0;
+static int          s_initialised       = 0;
 
 static void _init(void);
-static TimerID _get_free_timer(void);
-static void _free_timer(TimerID* timer_id);
-static uint64_t _timeval_to_ms(struct timeval tv);
+static TimerID _start(TimerCallback callback, void* args, uint64_t duration_ms, uint64_t period_ms);
+static uint32_t _alloc_node(void);
+static void _free_node(uint32_t index);
+static void _link(uint32_t index);
+static void _unlink(uint32_t index);
+static void _cascade(uint32_t level);
+static TimerNode* _resolve(TimerID timer_id);
 
-TimerID start_time_measure(void) {
-    _init();
+TimerID start_timer(TimerCallback callback, void* args, uint64_t duration_ms) {
+    return _start(callback, args, duration_ms, 0);
+}
 
-    TimerID available_timer = _get_free_timer();
-    if (available_timer != INVALID_TIMER_ID)
-        gettimeofday(&s_start_times[available_timer], NULL);
+TimerID start_periodic_timer(TimerCallback callback, void* args, uint64_t period_ms) {
+    // a zero period would fire on every tick forever
+    return _start(callback, args, period_ms, period_ms > 0 ? period_ms : 1);
+}
+
+void cancel_timer(TimerID* timer_id) {
+    TimerNode* node = _resolve(*timer_id);
+    if (node != NULL) {
+        const uint32_t index = (uint32_t)(*timer_id & 0xFFFFFFFF);
+        _unlink(index);
+        _free_node(index);
+    }
 
-    return available_timer;
+    // invalidate the caller's ID so it can't be used again
+    *timer_id = INVALID_TIMER_ID;
 }
 
-struct timeval end_time_measure(TimerID* timer_id) {
-    if (*timer_id > MAX_TIMERS || s_start_times[*timer_id].tv_sec == 0)
-        return (struct timeval) { .tv_sec = 0, .tv_usec = 0 };
+void timers_advance(uint64_t now_ms) {
+    _init();
 
-    struct timeval* start_time = &s_start_times[*timer_id];
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
+    while (s_current_ms < now_ms) {
+        s_current_ms++;
+
+        // whenever a level wraps, the next level's current slot is due to be
+        // spread out over the levels below it
+        for (uint32_t level = 1; level < WHEEL_LEVELS; ++level) {
+            const uint64_t lower_bits = s_current_ms & ((1ull << (level * WHEEL_SLOT_BITS)) - 1);
+            if (lower_bits != 0)
+                break;
+
+            _cascade(level);
+        }
+
+        // pop one at a time so a callback cancelling another timer in the
+        // same slot just takes it off the list we're walking
+        uint32_t* slot = &s_wheel[0][s_current_ms & WHEEL_SLOT_MASK];
+        while (*slot != NIL_NODE) {
+            const uint32_t index = *slot;
+            _unlink(index);
+
+            const TimerCallback callback = s_nodes[index].callback;
+            void* args = s_nodes[index].args;
+            const uint32_t generation = s_nodes[index].generation;
+
+            if (s_nodes[index].period_ms > 0) {
+                s_nodes[index].expires_ms += s_nodes[index].period_ms;
+                _link(index);
+            }
+
+            callback(args);
+
+            // one shot timers are done, unless the callback already freed it
+            if (s_nodes[index].in_use && s_nodes[index].generation == generation && s_nodes[index].period_ms == 0)
+                _free_node(index);
+        }
+    }
+}
 
-    const struct timeval time_diff = {
-        .tv_sec = current_time.tv_sec - start_time->tv_sec,
-        .tv_usec = current_time.tv_usec - start_time->tv_usec,
-    };
+uint64_t timers_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
 
-    _free_timer(timer_id);
+size_t timers_pending_count(void) {
+    return s_pending_count;
+}
 
-    return time_diff;
+void timers_free(void) {
+    free(s_nodes);
+    s_nodes = NULL;
+    s_node_capacity = 0;
+    s_free_head = NIL_NODE;
+    s_pending_count = 0;
+    s_initialised = 0;
 }
 
-char* pretty_format_time_diff(const struct timeval time_diff) {
-    const time_t sec = time_diff.tv_sec;
-    const time_t ms = time_diff.tv_usec / 1000;
+static void _init(void) {
+    if (s_initialised) return;
 
-    memset(s_pretty_format_buf, '\0', sizeof(s_pretty_format_buf[0]*PRETTY_FORMAT_BUF_SIZE));
-    snprintf(s_pretty_format_buf, PRETTY_FORMAT_BUF_SIZE-1, "%lds %ldms", sec, ms);
+    for (uint32_t level = 0; level < WHEEL_LEVELS; ++level) {
+        for (uint32_t slot = 0; slot < WHEEL_SLOTS; ++slot)
+            s_wheel[level][slot] = NIL_NODE;
+    }
 
-    return s_pretty_format_buf;
+    s_current_ms = timers_now_ms();
+    s_initialised = 1;
 }
 
-TimerID start_timer(TimerCallback callback, void* args, uint64_t duration_ms) {
+static TimerID _start(TimerCallback callback, void* args, uint64_t duration_ms, uint64_t period_ms) {
     _init();
 
     if (callback == NULL)
         return INVALID_TIMER_ID;
 
-    TimerID available_timer = _get_free_timer();
-    if (available_timer != INVALID_TIMER_ID) {
-        gettimeofday(&s_start_times[available_timer], NULL);
-        s_timer_durations[available_timer] = duration_ms;
+    const uint32_t index = _alloc_node();
+    if (index == NIL_NODE)
+        return INVALID_TIMER_ID;
 
-        s_timer_callbacks[available_timer] = (CallbackInfo) {
-            .callback = callback,
-            .args = args,
-        };
-    }
+    TimerNode* node = &s_nodes[index];
+    node->callback = callback;
+    node->args = args;
+    // a zero duration fires on the next tick rather than the one already fired
+    node->expires_ms = s_current_ms + (duration_ms > 0 ? duration_ms : 1);
+    node->period_ms = period_ms;
+    _link(index);
 
-    return available_timer;
+    return ((TimerID)node->generation << 32) | index;
 }
 
-void update_timer(TimerID* timer_id) {
-    if (*timer_id >= MAX_TIMERS)
-        return;
-
-    const struct timeval start_time     = s_start_times[*timer_id];
-    const uint64_t timer_duration_ms    = s_timer_durations[*timer_id];
-    const CallbackInfo callback_info    = s_timer_callbacks[*timer_id];
+static uint32_t _alloc_node(void) {
+    if (s_free_head == NIL_NODE) {
+        const uint32_t new_capacity = s_node_capacity > 0 ? s_node_capacity * 2 : INITIAL_NODE_CAPACITY;
+        if (new_capacity <= s_node_capacity || new_capacity == NIL_NODE)
+            return NIL_NODE;
 
-    if (callback_info.callback == NULL) {
-        _free_timer(timer_id);
-        return;
-    }
+        TimerNode* nodes = realloc(s_nodes, sizeof(TimerNode)*new_capacity);
+        if (nodes == NULL) {
+            fprintf(stderr, "ERROR: failed to grow timer pool to %u timers\n", new_capacity);
+            return NIL_NODE;
+        }
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
+        memset(nodes + s_node_capacity, 0, sizeof(TimerNode)*(new_capacity - s_node_capacity));
 
-    const uint64_t start_ms = _timeval_to_ms(start_time);
-    const uint64_t now_ms = _timeval_to_ms(now);
-    const uint64_t diff = now_ms - start_ms;
+        // thread the new nodes onto the free list, lowest index first
+        for (uint32_t i = new_capacity; i > s_node_capacity; --i) {
+            nodes[i - 1].next = s_free_head;
+            s_free_head = i - 1;
+        }
 
-    if (diff < timer_duration_ms)
-        return;
+        s_nodes = nodes;
+        s_node_capacity = new_capacity;
+    }
 
-    TimerCallback callback = callback_info.callback;
-    void* args = callback_info.args;
-    callback(args);
+    const uint32_t index = s_free_head;
+    s_free_head = s_nodes[index].next;
+    s_nodes[index].in_use = 1;
+    s_pending_count++;
 
-    _free_timer(timer_id);
+    return index;
 }
 
-static void _init(void) {
-    static int initialised = 0;
-    if (initialised) return;
-
-    memset(s_timer_in_use, 0, sizeof(s_timer_in_use[0])*MAX_TIMERS);
-    memset(s_start_times, 0, sizeof(s_start_times[0])*MAX_TIMERS);
-    memset(s_timer_callbacks, 0, sizeof(s_timer_callbacks[0])*MAX_TIMERS);
-    memset(s_timer_durations, 0, sizeof(s_timer_durations[0])*MAX_TIMERS);
+static void _free_node(uint32_t index) {
+    TimerNode* node = &s_nodes[index];
+    node->in_use = 0;
+    node->callback = NULL;
+    node->args = NULL;
+    node->generation++;
+    node->next = s_free_head;
+    s_free_head = index;
+    s_pending_count--;
+}
 
-    initialised = 1;
+static void _link(uint32_t index) {
+    TimerNode* node = &s_nodes[index];
+
+    // only a cascade can hand us a timer due this very tick, and it runs just
+    // before the current level 0 slot fires
+    const uint64_t expires_ms = node->expires_ms > s_current_ms ? node->expires_ms : s_current_ms;
+    const uint64_t delta = expires_ms - s_current_ms;
+
+    uint32_t level = 0;
+    while (level + 1 < WHEEL_LEVELS && delta >= (1ull << ((level + 1) * WHEEL_SLOT_BITS)))
+        ++level;
+
+    // too far out for the wheel, park it as far ahead as the top level reaches
+    const uint64_t slot_time = delta < WHEEL_RANGE ? expires_ms : s_current_ms + WHEEL_RANGE - 1;
+    const uint32_t slot = (slot_time >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+
+    node->level = level;
+    node->slot = slot;
+    node->linked = 1;
+    node->prev = NIL_NODE;
+    node->next = s_wheel[level][slot];
+    if (node->next != NIL_NODE)
+        s_nodes[node->next].prev = index;
+    s_wheel[level][slot] = index;
 }
 
-static TimerID _get_free_timer(void) {
-    TimerID available_timer = 0;
-    while (available_timer < MAX_TIMERS) {
-        printf("checking if %d is free\n", available_timer);
-        if (! s_timer_in_use[available_timer])
-            break;
+static void _unlink(uint32_t index) {
+    TimerNode* node = &s_nodes[index];
+    if (! node->linked)
+        return;
 
-        ++available_timer;
-    }
+    if (node->prev != NIL_NODE)
+        s_nodes[node->prev].next = node->next;
+    else
+        s_wheel[node->level][node->slot] = node->next;
 
-    if (available_timer >= MAX_TIMERS)
-        return INVALID_TIMER_ID;
+    if (node->next != NIL_NODE)
+        s_nodes[node->next].prev = node->prev;
 
-    s_timer_in_use[available_timer] = 1;
-    return available_timer;
+    node->prev = NIL_NODE;
+    node->next = NIL_NODE;
+    node->linked = 0;
 }
 
-static void _free_timer(TimerID* timer_id) {
-    s_timer_in_use[*timer_id] = 0;
-    memset(&s_start_times[*timer_id], 0, sizeof(s_start_times[0]));
-    memset(&s_timer_callbacks[*timer_id], 0, sizeof(s_timer_callbacks[0]));
-    s_timer_durations[*timer_id] = 0;
+static void _cascade(uint32_t level) {
+    const uint32_t slot = (s_current_ms >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
 
-    // invalidate the caller's ID so it can't be used again
-    *timer_id = INVALID_TIMER_ID;
-}
+    // detach the whole slot first, as re-filing can land back in it
+    uint32_t index = s_wheel[level][slot];
+    s_wheel[level][slot] = NIL_NODE;
 
-static uint64_t _timeval_to_ms(struct timeval tv) {
-    return (tv.tv_sec*1000) + (tv.tv_usec/1000);
+    while (index != NIL_NODE) {
+        const uint32_t next = s_nodes[index].next;
+        _link(index);
+        index = next;
+    }
 }
 
+static TimerNode* _resolve(TimerID timer_id) {
+    if (timer_id == INVALID_TIMER_ID)
+        return NULL;
+
+    const uint32_t index = (uint32_t)(timer_id & 0xFFFFFFFF);
+    const uint32_t generation = (uint32_t)(timer_id >> 32);
+    if (index >= s_node_capacity)
+        return NULL;
+
+    TimerNode* node = &s_nodes[index];
+    if (! node->in_use || node->generation != generation)
+        return NULL;
+
+    return node;
+}
@@ -2,19 +2,30 @@
 #define HELPERS_H
 
 #include <stdlib.h>
-#include <sys/time.h>
+#include <stdint.h>
 
-typedef uint32_t TimerID;
+// low 32 bits index the timer's slot, high 32 bits are the slot's generation
+// so an id held after its timer has fired or been cancelled is rejected
+typedef uint64_t TimerID;
 typedef void (*TimerCallback)(void* args);
 
-#define INVALID_TIMER_ID 0xFFFFFFFF
-
-TimerID start_time_measure(void);
-struct timeval end_time_measure(TimerID* timer_id);
-char* pretty_format_time_diff(const struct timeval time_diff);
+#define INVALID_TIMER_ID UINT64_MAX
 
+// timers live in a hierarchical timing wheel with millisecond ticks. starting
+// and cancelling are O(1), any number of timers can be pending, and a single
+// timers_advance call fires everything that has come due.
 TimerID start_timer(TimerCallback callback, void* args, uint64_t duration_ms);
-void update_timer(TimerID* timer_id);
+TimerID start_periodic_timer(TimerCallback callback, void* args, uint64_t period_ms);
+void cancel_timer(TimerID* timer_id);
 
-#endif // #ifndef HELPERS_H
+// fires every timer due at or before now_ms, in expiry order. callbacks may
+// start or cancel timers, including their own.
+void timers_advance(uint64_t now_ms);
+
+// the monotonic clock the wheel runs on
+uint64_t timers_now_ms(void);
 
+size_t timers_pending_count(void);
+void timers_free(void);
+
+#endif // #ifndef HELPERS_H
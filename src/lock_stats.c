@@ -0,0 +1,301 @@
+#include "lock_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+// distinct call sites a single thread can record, past that they're ignored
+#define SITES_PER_THREAD 16
+
+// counters are only ever written by the thread that owns them, so updates
+// are plain relaxed loads and stores and a query can read them at any time
+typedef struct {
+    _Atomic(const char*)    site;
+    atomic_uint_fast64_t    acquisitions;
+    atomic_uint_fast64_t    contended;
+    atomic_uint_fast64_t    total_wait_ns;
+    atomic_uint_fast64_t    max_wait_ns;
+    atomic_uint_fast64_t    total_hold_ns;
+    atomic_uint_fast64_t    max_hold_ns;
+    atomic_uint_fast64_t    wait_histogram[LOCK_STATS_BUCKETS];
+    atomic_uint_fast64_t    hold_histogram[LOCK_STATS_BUCKETS];
+} SiteCounters;
+
+// a site is filled in before site_count is bumped with release ordering, so a
+// query never sees one half set up
+typedef struct ThreadStats {
+    struct ThreadStats*     next;
+    uint32_t                thread_id;
+    _Atomic(const char*)    thread_name;
+    atomic_size_t           site_count;
+    SiteCounters            sites[SITES_PER_THREAD];
+} ThreadStats;
+
+static _Atomic(ThreadStats*)    s_threads = NULL;
+static atomic_uint              s_next_thread_id = 1;
+static _Thread_local ThreadStats* t_stats = NULL;
+
+// waits under the floor can't make the list, so most never touch the lock
+static pthread_mutex_t          s_stall_lock = PTHREAD_MUTEX_INITIALIZER;
+static LockStall                s_stalls[LOCK_STATS_STALLS];
+static size_t                   s_stall_count = 0;
+static atomic_uint_fast64_t     s_stall_floor = 0;
+
+static ThreadStats* _get_thread_stats(void);
+static SiteCounters* _get_site(const char* site);
+static void _record_stall(const ThreadStats* stats, const char* site, const uint64_t wait_ns);
+static void _add(atomic_uint_fast64_t* counter, const uint64_t value);
+static void _raise(atomic_uint_fast64_t* counter, const uint64_t value);
+static size_t _bucket(const uint64_t ns);
+static const char* _basename(const char* path);
+static uint64_t _now_ns(void);
+
+void lock_stats_record_wait(const char* site, const int contended, const uint64_t wait_ns) {
+    SiteCounters* counters = _get_site(site);
+    if (counters == NULL)
+        return;
+
+    _add(&counters->acquisitions, 1);
+    _add(&counters->total_wait_ns, wait_ns);
+    _raise(&counters->max_wait_ns, wait_ns);
+    _add(&counters->wait_histogram[_bucket(wait_ns)], 1);
+
+    if (contended) {
+        _add(&counters->contended, 1);
+        if (wait_ns > atomic_load_explicit(&s_stall_floor, memory_order_relaxed))
+            _record_stall(t_stats, site, wait_ns);
+    }
+}
+
+void lock_stats_record_hold(const char* site, const uint64_t hold_ns) {
+    SiteCounters* counters = _get_site(site);
+    if (counters == NULL)
+        return;
+
+    _add(&counters->total_hold_ns, hold_ns);
+    _raise(&counters->max_hold_ns, hold_ns);
+    _add(&counters->hold_histogram[_bucket(hold_ns)], 1);
+}
+
+void lock_stats_set_thread_name(const char* name) {
+    ThreadStats* stats = _get_thread_stats();
+    if (stats != NULL)
+        atomic_store_explicit(&stats->thread_name, name, memory_order_relaxed);
+}
+
+size_t lock_stats_query(LockSiteStats* o_stats, const size_t capacity) {
+    size_t total = 0;
+
+    for (ThreadStats* stats = atomic_load(&s_threads); stats != NULL; stats = stats->next) {
+        const size_t site_count = atomic_load_explicit(&stats->site_count, memory_order_acquire);
+        for (size_t i = 0; i < site_count; ++i, ++total) {
+            if (total >= capacity)
+                continue;
+
+            SiteCounters* counters = &stats->sites[i];
+            LockSiteStats* out = &o_stats[total];
+            *out = (LockSiteStats) {
+                .site           = atomic_load_explicit(&counters->site, memory_order_relaxed),
+                .thread_name    = atomic_load_explicit(&stats->thread_name, memory_order_relaxed),
+                .thread_id      = stats->thread_id,
+                .acquisitions   = atomic_load_explicit(&counters->acquisitions, memory_order_relaxed),
+                .contended      = atomic_load_explicit(&counters->contended, memory_order_relaxed),
+                .total_wait_ns  = atomic_load_explicit(&counters->total_wait_ns, memory_order_relaxed),
+                .max_wait_ns    = atomic_load_explicit(&counters->max_wait_ns, memory_order_relaxed),
+                .total_hold_ns  = atomic_load_explicit(&counters->total_hold_ns, memory_order_relaxed),
+                .max_hold_ns    = atomic_load_explicit(&counters->max_hold_ns, memory_order_relaxed),
+            };
+
+            for (size_t b = 0; b < LOCK_STATS_BUCKETS; ++b) {
+                out->wait_histogram[b] = atomic_load_explicit(&counters->wait_histogram[b], memory_order_relaxed);
+                out->hold_histogram[b] = atomic_load_explicit(&counters->hold_histogram[b], memory_order_relaxed);
+            }
+        }
+    }
+
+    return total;
+}
+
+size_t lock_stats_get_stalls(LockStall* o_stalls, const size_t capacity) {
+    pthread_mutex_lock(&s_stall_lock);
+    const size_t count = s_stall_count;
+    memcpy(o_stalls, s_stalls, sizeof(LockStall)*(count < capacity ? count : capacity));
+    pthread_mutex_unlock(&s_stall_lock);
+
+    // longest first
+    for (size_t i = 1; i < count && i < capacity; ++i) {
+        const LockStall stall = o_stalls[i];
+        size_t j = i;
+        for (; j > 0 && o_stalls[j - 1].wait_ns < stall.wait_ns; --j)
+            o_stalls[j] = o_stalls[j - 1];
+        o_stalls[j] = stall;
+    }
+
+    return count;
+}
+
+uint64_t lock_stats_percentile_ns(const uint64_t* histogram, const double fraction) {
+    uint64_t total = 0;
+    for (size_t b = 0; b < LOCK_STATS_BUCKETS; ++b)
+        total += histogram[b];
+
+    if (total == 0)
+        return 0;
+
+    const uint64_t target = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < LOCK_STATS_BUCKETS; ++b) {
+        seen += histogram[b];
+        if (seen > target)
+            return (uint64_t)1 << b;
+    }
+
+    return (uint64_t)1 << (LOCK_STATS_BUCKETS - 1);
+}
+
+void lock_stats_print(void) {
+    const size_t count = lock_stats_query(NULL, 0);
+    LockSiteStats* sites = malloc(sizeof(LockSiteStats)*count);
+    if (count > 0 && sites == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate lock stats for %zu sites\n", count);
+        return;
+    }
+
+    lock_stats_query(sites, count);
+    for (size_t i = 0; i < count; ++i) {
+        const LockSiteStats* site = &sites[i];
+        char thread[32];
+        if (site->thread_name == NULL)
+            snprintf(thread, sizeof(thread), "thread %u", site->thread_id);
+
+        printf("locks: %s at %s, %llu acquisitions, %llu contended\n",
+            site->thread_name != NULL ? site->thread_name : thread, _basename(site->site),
+            (unsigned long long)site->acquisitions, (unsigned long long)site->contended);
+        printf("locks:     wait p50 <%.1fus p99 <%.1fus max %.1fus total %.1fms, hold p50 <%.1fus p99 <%.1fus max %.1fus total %.1fms\n",
+            lock_stats_percentile_ns(site->wait_histogram, 0.5) / 1000.0,
+            lock_stats_percentile_ns(site->wait_histogram, 0.99) / 1000.0,
+            site->max_wait_ns / 1000.0, site->total_wait_ns / 1000000.0,
+            lock_stats_percentile_ns(site->hold_histogram, 0.5) / 1000.0,
+            lock_stats_percentile_ns(site->hold_histogram, 0.99) / 1000.0,
+            site->max_hold_ns / 1000.0, site->total_hold_ns / 1000000.0);
+    }
+
+    LockStall stalls[LOCK_STATS_STALLS];
+    const size_t stall_count = lock_stats_get_stalls(stalls, LOCK_STATS_STALLS);
+    for (size_t i = 0; i < stall_count; ++i) {
+        printf("locks: stall of %.1fus on thread %u at %s\n",
+            stalls[i].wait_ns / 1000.0, stalls[i].thread_id, _basename(stalls[i].site));
+    }
+
+    free(sites);
+}
+
+static ThreadStats* _get_thread_stats(void) {
+    if (t_stats != NULL)
+        return t_stats;
+
+    ThreadStats* stats = calloc(1, sizeof(ThreadStats));
+    if (stats == NULL)
+        return NULL;
+
+    stats->thread_id = atomic_fetch_add(&s_next_thread_id, 1);
+
+    // like the profiler's buffers these live until the process exits, so a
+    // query never has to worry about a thread that has already gone away
+    ThreadStats* head = atomic_load(&s_threads);
+    do {
+        stats->next = head;
+    } while (! atomic_compare_exchange_weak(&s_threads, &head, stats));
+
+    t_stats = stats;
+    return stats;
+}
+
+// sites are matched by address, each call site being its own literal
+static SiteCounters* _get_site(const char* site) {
+    ThreadStats* stats = _get_thread_stats();
+    if (stats == NULL)
+        return NULL;
+
+    const size_t site_count = atomic_load_explicit(&stats->site_count, memory_order_relaxed);
+    for (size_t i = 0; i < site_count; ++i) {
+        if (atomic_load_explicit(&stats->sites[i].site, memory_order_relaxed) == site)
+            return &stats->sites[i];
+    }
+
+    if (site_count == SITES_PER_THREAD)
+        return NULL;
+
+    SiteCounters* counters = &stats->sites[site_count];
+    atomic_store_explicit(&counters->site, site, memory_order_relaxed);
+    atomic_store_explicit(&stats->site_count, site_count + 1, memory_order_release);
+    return counters;
+}
+
+static void _record_stall(const ThreadStats* stats, const char* site, const uint64_t wait_ns) {
+    pthread_mutex_lock(&s_stall_lock);
+
+    // the shortest stall makes way, once the list is full
+    size_t slot = s_stall_count;
+    const int appended = s_stall_count < LOCK_STATS_STALLS;
+    if (! appended) {
+        slot = 0;
+        for (size_t i = 1; i < LOCK_STATS_STALLS; ++i) {
+            if (s_stalls[i].wait_ns < s_stalls[slot].wait_ns)
+                slot = i;
+        }
+    } else {
+        s_stall_count++;
+    }
+
+    if (appended || wait_ns > s_stalls[slot].wait_ns) {
+        s_stalls[slot] = (LockStall) {
+            .site       = site,
+            .thread_id  = stats->thread_id,
+            .wait_ns    = wait_ns,
+            .at_ns      = _now_ns(),
+        };
+    }
+
+    // only a full list has a floor, until then every stall gets in
+    if (s_stall_count == LOCK_STATS_STALLS) {
+        uint64_t floor = s_stalls[0].wait_ns;
+        for (size_t i = 1; i < LOCK_STATS_STALLS; ++i) {
+            if (s_stalls[i].wait_ns < floor)
+                floor = s_stalls[i].wait_ns;
+        }
+        atomic_store_explicit(&s_stall_floor, floor, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&s_stall_lock);
+}
+
+static void _add(atomic_uint_fast64_t* counter, const uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void _raise(atomic_uint_fast64_t* counter, const uint64_t value) {
+    if (value > atomic_load_explicit(counter, memory_order_relaxed))
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+static size_t _bucket(const uint64_t ns) {
+    if (ns == 0)
+        return 0;
+
+    const size_t bucket = 64 - __builtin_clzll(ns);
+    return bucket < LOCK_STATS_BUCKETS ? bucket : LOCK_STATS_BUCKETS - 1;
+}
+
+static const char* _basename(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
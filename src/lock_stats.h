@@ -0,0 +1,75 @@
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// contention telemetry for instrumented locks. every acquisition records how
+// long it waited and how long the lock was then held, per call site and per
+// thread, into log2 histograms alongside counts and the longest stalls seen.
+// build with ECS_ENABLE_LOCK_STATS to turn it on; otherwise nothing is
+// recorded, queries come back empty and the macros compile away.
+
+// bucket 0 counts durations under 1ns, bucket b those in [2^(b-1), 2^b) ns,
+// and the last bucket everything longer
+#define LOCK_STATS_BUCKETS 40
+
+// the longest waits kept across every site and thread
+#define LOCK_STATS_STALLS 8
+
+#define LOCK_STATS_STR_(x) #x
+#define LOCK_STATS_STR(x) LOCK_STATS_STR_(x)
+#define LOCK_STATS_SITE (__FILE__ ":" LOCK_STATS_STR(__LINE__))
+
+typedef struct {
+    const char* site;
+    const char* thread_name;    // NULL for threads that never named themselves
+    uint32_t    thread_id;
+    uint64_t    acquisitions;
+    uint64_t    contended;      // acquisitions that found the lock taken
+    uint64_t    total_wait_ns;
+    uint64_t    max_wait_ns;
+    uint64_t    total_hold_ns;
+    uint64_t    max_hold_ns;
+    uint64_t    wait_histogram[LOCK_STATS_BUCKETS];
+    uint64_t    hold_histogram[LOCK_STATS_BUCKETS];
+} LockSiteStats;
+
+typedef struct {
+    const char* site;
+    uint32_t    thread_id;
+    uint64_t    wait_ns;
+    uint64_t    at_ns;          // CLOCK_MONOTONIC when the wait ended
+} LockStall;
+
+// sites must be string literals, or otherwise outlive the process. the hold
+// is recorded against the site that took the lock
+void lock_stats_record_wait(const char* site, const int contended, const uint64_t wait_ns);
+void lock_stats_record_hold(const char* site, const uint64_t hold_ns);
+void lock_stats_set_thread_name(const char* name);
+
+// safe to call from any thread while locks are being recorded, although a
+// site's counters may be a few acquisitions apart from each other. both copy
+// out up to capacity entries and return how many there are in total
+size_t lock_stats_query(LockSiteStats* o_stats, const size_t capacity);
+size_t lock_stats_get_stalls(LockStall* o_stalls, const size_t capacity);
+
+// upper bound in ns of the bucket holding the given fraction of a histogram
+uint64_t lock_stats_percentile_ns(const uint64_t* histogram, const double fraction);
+
+// writes every site and the longest stalls to stdout
+void lock_stats_print(void);
+
+#ifdef ECS_ENABLE_LOCK_STATS
+
+#define LOCK_STATS_THREAD_NAME(name)    lock_stats_set_thread_name(name)
+#define LOCK_STATS_PRINT()              lock_stats_print()
+
+#else
+
+#define LOCK_STATS_THREAD_NAME(name)    ((void)0)
+#define LOCK_STATS_PRINT()              ((void)0)
+
+#endif // #ifdef ECS_ENABLE_LOCK_STATS
+
+#endif // #ifndef LOCK_STATS_H
@@ -1,57 +1,106 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <string.h>
 #include <math.h>
-#include <pthread/sched.h>
+#include <time.h>
 
 #include "raylib.h"
 #include "ecs.h"
 #include "systems.h"
 #include "physics_thread.h"
 #include "helpers.h"
+#include "thread_pool.h"
+#include "render_snapshot.h"
+#include "render_backend.h"
+#include "profiler.h"
+#include "lock_stats.h"
+#include "perf_counters.h"
+#include "command_buffer.h"
+#include "recording.h"
 
 #define WINDOW_WIDTH 512
 #define WINDOW_HEIGHT 512
 
 #define MAX_ENTITY_COUNT 1000
 #define START_ENTITY_COUNT 0
-#define MAX_COMPONENTS 1000
+
+// every entity in the demo is a bouncing, drawn circle
+#define ENTITY_COMPONENTS (COMPONENT_POSITION | COMPONENT_DISPLAY | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER)
+
+// extra threads sharing each physics step, on top of the physics thread itself
+#define PHYSICS_WORKER_COUNT thread_pool_default_worker_count()
+
+#define PROFILE_TRACE_PATH "c-ecs-trace.json"
+
+// recordings are played back a frame per physics step
+#define REPLAY_FRAME_MS ((uint64_t)(1000 / DEFAULT_PHYSICS_STEPS_PER_SECOND))
 
 #define STAGES 10
 #define STAGE_DELAY_MS 2 * 1000
 
-static EntityID s_entities[MAX_ENTITY_COUNT];
+static EcsWorld* s_world = NULL;
+static CommandQueue* s_commands = NULL;
 static size_t s_entity_count = 0;
 static int s_running = 1;
 static size_t s_entities_per_stage = MAX_ENTITY_COUNT / STAGES;
-static TimerID s_stage_timers[STAGES];
-
+static TimerID s_stage_timer = INVALID_TIMER_ID;
+static const char* s_restore_path = NULL;
+static const char* s_checkpoint_path = NULL;
+static const char* s_record_path = NULL;
+static const char* s_replay_path = NULL;
+static Recorder* s_recorder = NULL;
+static Replay* s_replay = NULL;
+static RenderBackend* s_render_backend = NULL;
+static int s_simulating = 0;
+
+static int _parse_args(int argc, char** argv);
+static void _start_simulation(void);
+static void _start_replay(void);
+static void _advance_replay(void* args);
 static void _init_entities(void);
-static EntityID _create_entity(void);
+static void _init_entity_batch(void* context, const EcsSpawnBatch* batch);
 static void _add_entities(void* args);
 static void _end_benchmark(void* args);
+static void _draw_collision_stats(void);
+static void _print_physics_timing(void);
+static void _print_recorder_stats(void);
+static void _print_render_stats(void);
+static void _print_memory_report(void);
 
 static void _rand_init(void);
 static int _irand_range(int min, int max);
 static float _frand_range(float min, float max);
 
-int main(void) {
-    assert(MAX_ENTITY_COUNT <= MAX_COMPONENTS);
+int main(int argc, char** argv) {
+    PROFILE_THREAD_NAME("render");
+    LOCK_STATS_THREAD_NAME("render");
 
-    InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "c ecs");
-    ecs_init(MAX_COMPONENTS);
-    _init_entities();
-
-    if (! start_physics_thread())
-        s_running = 0;
+    if (! _parse_args(argc, argv))
+        return 1;
 
-    for (size_t i = 0; i < STAGES; ++i) {
-        const uint64_t timer_duration_ms = STAGE_DELAY_MS * (i+1);
-        s_stage_timers[i] = start_timer(_add_entities, &s_entities_per_stage, timer_duration_ms);
+    InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "c ecs");
+    s_world = s_restore_path != NULL ? ecs_load_snapshot(s_restore_path, NULL) : ecs_world_create(NULL);
+    s_commands = command_queue_create();
+    s_render_backend = render_backend_create_raylib(DEFAULT_RAYLIB_CIRCLE_SEGMENTS);
+    if (s_world == NULL || s_commands == NULL || s_render_backend == NULL) {
+        fprintf(stderr, "ERROR: failed to create the world\n");
+        render_backend_destroy(s_render_backend);
+        command_queue_destroy(s_commands);
+        ecs_world_destroy(s_world);
+        CloseWindow();
+        return 1;
     }
 
-    const uint64_t benchmark_duration_ms = (STAGE_DELAY_MS * STAGES) + (2*1000);
-    TimerID benchmark_timer = start_timer(_end_benchmark, NULL, benchmark_duration_ms);
+    render_snapshot_init();
+    if (s_restore_path == NULL)
+        _init_entities();
+    else
+        s_entity_count = ecs_entity_count(s_world);
+
+    if (s_replay_path != NULL)
+        _start_replay();
+    else
+        _start_simulation();
 
     while (! WindowShouldClose() && s_running) {
         // drawing
@@ -59,75 +108,171 @@ int main(void) {
         {
             ClearBackground(RAYWHITE);
 
-            ecs_lock_mutex();
-
-            system_draw();
-
-            ecs_unlock_mutex();
-            sched_yield();
+            // the physics thread hands over finished frames, so drawing
+            // never has to hold the ecs lock
+            system_draw(s_render_backend, render_snapshot_acquire());
 
             DrawFPS(0, 0);
+            _draw_collision_stats();
 
-            for (size_t i = 0; i < STAGES; ++i) {
-                update_timer(&s_stage_timers[i]);
-            }
-            update_timer(&benchmark_timer);
+            timers_advance(timers_now_ms());
         }
         EndDrawing();
     }
 
-    join_physics_thread();
+    if (s_simulating) {
+        join_physics_thread();
+        _print_physics_timing();
+    }
+
+    _print_memory_report();
+
+    if (s_recorder != NULL) {
+        _print_recorder_stats();
+        recorder_destroy(s_recorder);
+    }
+
+    replay_close(s_replay);
+    _print_render_stats();
+    LOCK_STATS_PRINT();
+    PERF_COUNTERS_PRINT(stdout);
+    PROFILE_DUMP(PROFILE_TRACE_PATH);
+
+    // the physics thread is gone, so the world is safe to read unlocked
+    if (s_checkpoint_path != NULL && ecs_save_snapshot(s_world, s_checkpoint_path))
+        printf("saved checkpoint to %s\n", s_checkpoint_path);
 
     CloseWindow();
-    ecs_free();
+    render_snapshot_free();
+    timers_free();
+    render_backend_destroy(s_render_backend);
+    command_queue_destroy(s_commands);
+    ecs_world_destroy(s_world);
 
     return 0;
 }
 
-static void _init_entities(void) {
-    for (size_t i = 0; i < START_ENTITY_COUNT; ++i) {
-        s_entities[i] = _create_entity();
-        s_entity_count++;
+static int _parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            s_restore_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            s_checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            s_record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            s_replay_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--restore SNAPSHOT] [--checkpoint SNAPSHOT] [--record RECORDING | --replay RECORDING]\n", argv[0]);
+            return 0;
+        }
     }
-}
 
-static EntityID _create_entity(void) {
-    EntityID id = ecs_new_entity();
+    return 1;
+}
 
-    PositionComponent* pos          = ecs_new_position_component(id);
-    DisplayComponent* disp          = ecs_new_display_component(id);
-    RigidBodyComponent* rb          = ecs_new_rigid_body_component(id);
-    CircleColliderComponent* col    = ecs_new_circle_collider_component(id);
+static void _start_simulation(void) {
+    if (s_record_path != NULL) {
+        s_recorder = recorder_create(s_record_path, NULL);
+        if (s_recorder == NULL) {
+            s_running = 0;
+            return;
+        }
+    }
 
-    pos->pos.x = _irand_range(0, WINDOW_WIDTH);
-    pos->pos.y = _irand_range(0, WINDOW_HEIGHT);
-    disp->color = (Color) {
-        .r = _irand_range(0, 255),
-        .g = _irand_range(0, 255),
-        .b = _irand_range(0, 255),
-        .a = 255,
+    const PhysicsThreadConfig physics_config = {
+        .world              = s_world,
+        .commands           = s_commands,
+        .recorder           = s_recorder,
+        .steps_per_second   = DEFAULT_PHYSICS_STEPS_PER_SECOND,
+        .max_catch_up_steps = DEFAULT_PHYSICS_MAX_CATCH_UP_STEPS,
+        .worker_count       = PHYSICS_WORKER_COUNT,
+        .bounds = {
+            .x = WINDOW_WIDTH,
+            .y = WINDOW_HEIGHT,
+        },
     };
 
-    disp->radius = _irand_range(3, 15);
+    s_simulating = start_physics_thread(&physics_config);
+    if (! s_simulating) {
+        s_running = 0;
+        return;
+    }
+
+    s_stage_timer = start_periodic_timer(_add_entities, &s_entities_per_stage, STAGE_DELAY_MS);
+
+    const uint64_t benchmark_duration_ms = (STAGE_DELAY_MS * STAGES) + (2*1000);
+    start_timer(_end_benchmark, NULL, benchmark_duration_ms);
+}
+
+// the physics thread never starts, frames come straight out of the recording
+// and through the same snapshot the simulation would have published
+static void _start_replay(void) {
+    s_replay = replay_open(s_replay_path);
+    if (s_replay == NULL) {
+        s_running = 0;
+        return;
+    }
+
+    start_periodic_timer(_advance_replay, NULL, REPLAY_FRAME_MS);
+}
 
-    col->radius = disp->radius;
+static void _advance_replay(void* args) {
+    (void)args;
 
-    rb->mass = col->radius / 10.f;
-    rb->velocity.x = _frand_range(-500.f, 500.f);
-    rb->velocity.y = _frand_range(-50.f, 50.f);
+    ReplayFrame frame;
+    if (! replay_next(s_replay, &frame)) {
+        // the recording has run out
+        s_running = 0;
+        return;
+    }
 
-    // move entities within the bounds of the screen
-    if (pos->pos.x - disp->radius < 0)
-        pos->pos.x = disp->radius;
-    else if (pos->pos.x + disp->radius > WINDOW_WIDTH)
-        pos->pos.x = WINDOW_WIDTH - disp->radius;
+    RenderSnapshot* snapshot = render_snapshot_begin_write();
+    system_extract_replay_snapshot(&frame, snapshot);
+    render_snapshot_publish();
+}
 
-    if (pos->pos.y - disp->radius < 0)
-        pos->pos.y = disp->radius;
-    else if (pos->pos.y + disp->radius > WINDOW_HEIGHT)
-        pos->pos.y = WINDOW_HEIGHT - disp->radius;
+static void _init_entities(void) {
+    if (ecs_spawn_batch(s_world, START_ENTITY_COUNT, ENTITY_COMPONENTS, _init_entity_batch, NULL, NULL))
+        s_entity_count = START_ENTITY_COUNT;
+}
 
-    return id;
+static void _init_entity_batch(void* context, const EcsSpawnBatch* batch) {
+    (void)context;
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        float x = _irand_range(0, WINDOW_WIDTH);
+        float y = _irand_range(0, WINDOW_HEIGHT);
+        const float radius = _irand_range(3, 15);
+
+        // move entities within the bounds of the screen
+        if (x - radius < 0)
+            x = radius;
+        else if (x + radius > WINDOW_WIDTH)
+            x = WINDOW_WIDTH - radius;
+
+        if (y - radius < 0)
+            y = radius;
+        else if (y + radius > WINDOW_HEIGHT)
+            y = WINDOW_HEIGHT - radius;
+
+        batch->position.x[i] = x;
+        batch->position.y[i] = y;
+
+        batch->display.radius[i] = radius;
+        batch->display.color[i] = (Color) {
+            .r = _irand_range(0, 255),
+            .g = _irand_range(0, 255),
+            .b = _irand_range(0, 255),
+            .a = 255,
+        };
+
+        batch->circle_collider.radius[i] = radius;
+
+        batch->rigid_body.mass[i] = radius / 10.f;
+        batch->rigid_body.velocity_x[i] = _frand_range(-500.f, 500.f);
+        batch->rigid_body.velocity_y[i] = _frand_range(-50.f, 50.f);
+    }
 }
 
 static void _add_entities(void* args) {
@@ -135,16 +280,24 @@ static void _add_entities(void* args) {
         return;
 
     const size_t count = *(size_t*)args;
-    if (s_entity_count + count > MAX_ENTITY_COUNT)
+    if (s_entity_count + count > MAX_ENTITY_COUNT) {
+        // every stage has run, the stage timer has nothing left to do
+        cancel_timer(&s_stage_timer);
         return;
+    }
 
-    ecs_lock_mutex();
-    for (size_t i = 0; i < count; ++i) {
-        EntityID id = _create_entity();
-        s_entities[s_entity_count] = id;
-        s_entity_count++;
+    PROFILE_SCOPE("spawn_entities");
+
+    // the physics thread spawns the batch between steps, so the render
+    // thread never has to wait on the ecs lock
+    CommandBuffer* commands = command_buffer_create();
+    if (commands == NULL || ! command_buffer_spawn_batch(commands, count, ENTITY_COMPONENTS, _init_entity_batch, NULL)) {
+        command_buffer_destroy(commands);
+        return;
     }
-    ecs_unlock_mutex();
+
+    command_buffer_submit(s_commands, commands);
+    s_entity_count += count;
 }
 
 static void _end_benchmark(void* args) {
@@ -152,6 +305,71 @@ static void _end_benchmark(void* args) {
     s_running = 0;
 }
 
+static void _draw_collision_stats(void) {
+    CollisionStats stats;
+    physics_thread_get_collision_stats(&stats);
+
+    char text[128];
+    snprintf(text, sizeof(text), "pairs: %zu contacts: %zu broadphase: %.3fms",
+        stats.candidate_pairs, stats.contacts, stats.broadphase_ns / 1000000.0);
+    DrawText(text, 0, 20, 10, BLACK);
+}
+
+static void _print_physics_timing(void) {
+    PhysicsTimingStats stats;
+    physics_thread_get_timing_stats(&stats);
+
+    printf("physics: %llu steps over %llu ticks, %llu overruns, %llu dropped steps\n",
+        (unsigned long long)stats.steps, (unsigned long long)stats.ticks,
+        (unsigned long long)stats.overruns, (unsigned long long)stats.dropped_steps);
+    printf("physics: wake jitter mean %.1fus max %.1fus, step time max %.1fus, draw list extraction max %.1fus\n",
+        stats.mean_jitter_ns / 1000.0, stats.max_jitter_ns / 1000.0, stats.max_step_ns / 1000.0,
+        stats.max_extract_ns / 1000.0);
+}
+
+static void _print_render_stats(void) {
+    RenderStats stats;
+    render_backend_get_stats(s_render_backend, &stats);
+
+    printf("render: %s backend, %llu frames, %llu circles, submit mean %.1fus max %.1fus\n",
+        render_backend_name(s_render_backend), (unsigned long long)stats.frames, (unsigned long long)stats.circles,
+        stats.mean_submit_ns / 1000.0, stats.max_submit_ns / 1000.0);
+}
+
+// the physics thread has to be gone, as this reads the world unlocked
+static void _print_memory_report(void) {
+    static const char* pool_names[COMPONENT_TYPE_COUNT] = {
+        [COMPONENT_TYPE_POSITION]           = "position",
+        [COMPONENT_TYPE_DISPLAY]            = "display",
+        [COMPONENT_TYPE_RIGID_BODY]         = "rigid body",
+        [COMPONENT_TYPE_CIRCLE_COLLIDER]    = "circle collider",
+    };
+
+    EcsMemoryStats stats;
+    ecs_get_memory_stats(s_world, &stats);
+
+    double bytes_per_entity = stats.bytes_per_entity;
+    printf("memory: %zu entities, %.1f bytes each for handles, %.1fKiB committed\n",
+        stats.entity_count, stats.bytes_per_entity, stats.committed_bytes / 1024.0);
+    for (size_t type = 0; type < COMPONENT_TYPE_COUNT; ++type) {
+        const EcsPoolMemory* pool = &stats.pools[type];
+        printf("memory: %s pool, %zu of %zu slots, %.1f bytes per entity, %.1fKiB committed\n",
+            pool_names[type], pool->count, pool->capacity, pool->bytes_per_entity, pool->committed_bytes / 1024.0);
+        bytes_per_entity += pool->bytes_per_entity;
+    }
+
+    printf("memory: %.1f bytes per entity with every component\n", bytes_per_entity);
+}
+
+static void _print_recorder_stats(void) {
+    RecorderStats stats;
+    recorder_get_stats(s_recorder, &stats);
+
+    printf("recording: %llu frames, %llu dropped, %.1fKiB\n",
+        (unsigned long long)stats.frames_written, (unsigned long long)stats.frames_dropped,
+        stats.bytes_written / 1024.0);
+}
+
 static void _rand_init(void) {
     static int rand_init = 0;
     if (! rand_init) {
@@ -0,0 +1,281 @@
+#include "perf_counters.h"
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// one thread's counters, opened as a single group so they're all scheduled
+// onto the pmu together and read with one syscall. `slots` maps each counter
+// to its place in the group, which skips any that failed to open.
+typedef struct {
+    int         group_fd;
+    int         fds[PERF_COUNTER_COUNT];
+    size_t      slots[PERF_COUNTER_COUNT];
+    size_t      opened;
+    uint32_t    available;
+} PerfThread;
+
+typedef struct {
+    const char* name;
+    uint64_t    samples;
+    uint64_t    entities;
+    uint64_t    values[PERF_COUNTER_COUNT];
+    uint32_t    available;
+} PerfRegion;
+
+static const char* s_counter_names[PERF_COUNTER_COUNT] = {
+    [PERF_COUNTER_CYCLES]           = "cycles",
+    [PERF_COUNTER_INSTRUCTIONS]     = "instructions",
+    [PERF_COUNTER_L1D_MISSES]       = "l1d misses",
+    [PERF_COUNTER_LLC_MISSES]       = "llc misses",
+    [PERF_COUNTER_BRANCH_MISSES]    = "branch misses",
+};
+
+static pthread_mutex_t  s_region_lock = PTHREAD_MUTEX_INITIALIZER;
+static PerfRegion       s_regions[MAX_PERF_REGIONS];
+static size_t           s_region_count = 0;
+
+static pthread_once_t   s_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    s_thread_key;
+static atomic_uint      s_warned = 0;
+static _Thread_local PerfThread* t_thread = NULL;
+static _Thread_local int t_tried = 0;
+
+static PerfThread* _get_thread(void);
+static void _create_key(void);
+static void _destroy_thread(void* context);
+static int _read_counters(const PerfThread* thread, uint64_t* o_values);
+static void _warn_once(const uint32_t counters, const int error);
+
+PerfScope perf_scope_begin(const char* name, const size_t entities) {
+    PerfScope scope = {
+        .name       = name,
+        .entities   = entities,
+        .valid      = 0,
+    };
+
+    const PerfThread* thread = _get_thread();
+    if (thread != NULL)
+        scope.valid = _read_counters(thread, scope.values);
+
+    return scope;
+}
+
+void perf_scope_end(PerfScope* scope) {
+    uint64_t values[PERF_COUNTER_COUNT];
+    const PerfThread* thread = t_thread;
+    if (! scope->valid || thread == NULL || ! _read_counters(thread, values))
+        return;
+
+    pthread_mutex_lock(&s_region_lock);
+
+    PerfRegion* region = NULL;
+    for (size_t i = 0; i < s_region_count && region == NULL; ++i) {
+        if (s_regions[i].name == scope->name)
+            region = &s_regions[i];
+    }
+
+    if (region == NULL && s_region_count < MAX_PERF_REGIONS) {
+        region = &s_regions[s_region_count++];
+        *region = (PerfRegion) {
+            .name       = scope->name,
+            .available  = (1u << PERF_COUNTER_COUNT) - 1,
+        };
+    }
+
+    if (region != NULL) {
+        region->samples++;
+        region->entities += scope->entities;
+        region->available &= thread->available;
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+            region->values[i] += values[i] - scope->values[i];
+    }
+
+    pthread_mutex_unlock(&s_region_lock);
+}
+
+size_t perf_counters_query(PerfRegionStats* o_stats, const size_t capacity) {
+    pthread_mutex_lock(&s_region_lock);
+
+    const size_t count = s_region_count;
+    for (size_t i = 0; i < count && i < capacity; ++i) {
+        const PerfRegion* region = &s_regions[i];
+        o_stats[i] = (PerfRegionStats) {
+            .name       = region->name,
+            .samples    = region->samples,
+            .entities   = region->entities,
+            .available  = region->available,
+        };
+        memcpy(o_stats[i].values, region->values, sizeof(region->values));
+    }
+
+    pthread_mutex_unlock(&s_region_lock);
+    return count;
+}
+
+void perf_counters_reset(void) {
+    pthread_mutex_lock(&s_region_lock);
+    s_region_count = 0;
+    pthread_mutex_unlock(&s_region_lock);
+}
+
+const char* perf_counter_name(const PerfCounter counter) {
+    return counter < PERF_COUNTER_COUNT ? s_counter_names[counter] : "(unknown)";
+}
+
+void perf_counters_print(FILE* file) {
+    PerfRegionStats regions[MAX_PERF_REGIONS];
+    const size_t count = perf_counters_query(regions, MAX_PERF_REGIONS);
+    if (count == 0) {
+        fprintf(file, "perf: no counters recorded\n");
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const PerfRegionStats* region = &regions[i];
+        const double entities = region->entities > 0 ? (double)region->entities : 1.0;
+
+        fprintf(file, "perf: %s, %llu samples over %llu entities, per entity:",
+            region->name, (unsigned long long)region->samples, (unsigned long long)region->entities);
+
+        for (size_t c = 0; c < PERF_COUNTER_COUNT; ++c) {
+            if (region->available & (1u << c))
+                fprintf(file, " %.3f %s%s", region->values[c] / entities, s_counter_names[c], c + 1 < PERF_COUNTER_COUNT ? "," : "");
+            else
+                fprintf(file, " n/a %s%s", s_counter_names[c], c + 1 < PERF_COUNTER_COUNT ? "," : "");
+        }
+
+        const uint32_t ipc_mask = (1u << PERF_COUNTER_CYCLES) | (1u << PERF_COUNTER_INSTRUCTIONS);
+        if ((region->available & ipc_mask) == ipc_mask && region->values[PERF_COUNTER_CYCLES] > 0)
+            fprintf(file, " (%.2f ipc)", (double)region->values[PERF_COUNTER_INSTRUCTIONS] / region->values[PERF_COUNTER_CYCLES]);
+
+        fprintf(file, "\n");
+    }
+}
+
+// NULL if this thread couldn't open a single counter, which is only tried once
+static PerfThread* _get_thread(void) {
+    if (t_thread != NULL || t_tried)
+        return t_thread;
+
+    t_tried = 1;
+
+#ifdef __linux__
+    static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTER_COUNT] = {
+        [PERF_COUNTER_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        [PERF_COUNTER_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        [PERF_COUNTER_L1D_MISSES]       = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        [PERF_COUNTER_LLC_MISSES]       = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        [PERF_COUNTER_BRANCH_MISSES]    = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    PerfThread* thread = calloc(1, sizeof(PerfThread));
+    if (thread == NULL)
+        return NULL;
+
+    thread->group_fd = -1;
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        // only this thread, on whichever cpu it happens to run
+        const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, thread->group_fd, 0);
+        thread->fds[i] = fd;
+        if (fd < 0) {
+            _warn_once(1u << i, errno);
+            continue;
+        }
+
+        if (thread->group_fd < 0)
+            thread->group_fd = fd;
+
+        thread->slots[i] = thread->opened++;
+        thread->available |= 1u << i;
+    }
+
+    if (thread->opened == 0) {
+        free(thread);
+        return NULL;
+    }
+
+    pthread_once(&s_key_once, _create_key);
+    pthread_setspecific(s_thread_key, thread);
+
+    t_thread = thread;
+    return thread;
+#else
+    _warn_once((1u << PERF_COUNTER_COUNT) - 1, ENOSYS);
+    return NULL;
+#endif
+}
+
+static void _create_key(void) {
+    pthread_key_create(&s_thread_key, _destroy_thread);
+}
+
+// closes a thread's counters as it exits
+static void _destroy_thread(void* context) {
+    PerfThread* thread = context;
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (thread->fds[i] >= 0)
+            close(thread->fds[i]);
+    }
+#endif
+    free(thread);
+}
+
+// counters are scaled up by how long they were actually on the pmu, in case
+// the kernel had to multiplex them with someone else's
+static int _read_counters(const PerfThread* thread, uint64_t* o_values) {
+#ifdef __linux__
+    uint64_t buffer[3 + PERF_COUNTER_COUNT];
+    const ssize_t expected = (ssize_t)(sizeof(uint64_t) * (3 + thread->opened));
+    if (read(thread->group_fd, buffer, sizeof(buffer)) != expected)
+        return 0;
+
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    if (running == 0)
+        return 0;
+
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (thread->available & (1u << i)) {
+            const uint64_t value = buffer[3 + thread->slots[i]];
+            o_values[i] = running < enabled ? (uint64_t)((double)value * enabled / running) : value;
+        } else {
+            o_values[i] = 0;
+        }
+    }
+
+    return 1;
+#else
+    (void)thread;
+    (void)o_values;
+    return 0;
+#endif
+}
+
+// once per counter, not once per thread
+static void _warn_once(const uint32_t counters, const int error) {
+    const uint32_t warned = atomic_fetch_or(&s_warned, counters);
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if ((counters & ~warned) & (1u << i))
+            fprintf(stderr, "WARNING: %s counter unavailable (%s)\n", s_counter_names[i], strerror(error));
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// hardware performance counters around named regions of code, read through
+// perf_event_open on linux. each thread opens its own counters the first time
+// it enters a region, and regions add up across every thread that ran them,
+// so a system split over the thread pool can be measured chunk by chunk.
+// build with ECS_ENABLE_PERF_COUNTERS to turn it on; otherwise every macro
+// compiles away.
+//
+// counters the kernel or cpu won't give us (containers, virtual machines,
+// a strict perf_event_paranoid) are left out with a warning and reported as
+// unavailable, and with none at all regions simply record nothing.
+//
+//     void system_foo(EcsWorld* world, size_t begin, size_t end) {
+//         PERF_SCOPE("system_foo", end - begin);
+//         ...
+//     }
+
+typedef enum {
+    PERF_COUNTER_CYCLES = 0,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_L1D_MISSES,
+    PERF_COUNTER_LLC_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_COUNT,
+} PerfCounter;
+
+#define MAX_PERF_REGIONS 16
+
+typedef struct {
+    const char* name;
+    size_t      entities;
+    int         valid;
+    uint64_t    values[PERF_COUNTER_COUNT];
+} PerfScope;
+
+typedef struct {
+    const char* name;
+    uint64_t    samples;
+    uint64_t    entities;
+    uint64_t    values[PERF_COUNTER_COUNT];
+
+    // bit per PerfCounter, set only if every sample had that counter
+    uint32_t    available;
+} PerfRegionStats;
+
+// names must be string literals, or otherwise outlive the process. entities
+// is how much work the region does, for per entity figures
+PerfScope perf_scope_begin(const char* name, const size_t entities);
+void perf_scope_end(PerfScope* scope);
+
+// copies out up to capacity regions, returns how many there are in total
+size_t perf_counters_query(PerfRegionStats* o_stats, const size_t capacity);
+void perf_counters_reset(void);
+const char* perf_counter_name(const PerfCounter counter);
+
+// per entity figures for every region
+void perf_counters_print(FILE* file);
+
+#ifdef ECS_ENABLE_PERF_COUNTERS
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+
+#define PERF_SCOPE(name, entities)                                              \
+    PerfScope PERF_CONCAT(_perf_scope_, __LINE__)                               \
+        __attribute__((cleanup(perf_scope_end))) = perf_scope_begin(name, entities)
+
+#define PERF_COUNTERS_RESET()       perf_counters_reset()
+#define PERF_COUNTERS_PRINT(file)   perf_counters_print(file)
+
+#else
+
+#define PERF_SCOPE(name, entities)  ((void)0)
+#define PERF_COUNTERS_RESET()       ((void)0)
+#define PERF_COUNTERS_PRINT(file)   ((void)0)
+
+#endif // #ifdef ECS_ENABLE_PERF_COUNTERS
+
+#endif // #ifndef PERF_COUNTERS_H
@@ -0,0 +1,212 @@
+#include "physics_kernel.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "vec_maths.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_VEC8_KERNEL 1
+#define VEC8_TARGET __attribute__((target("avx")))
+#else
+#define HAS_VEC8_KERNEL 0
+#endif
+
+typedef void (*IntegrateFn)(const PhysicsBodies*, const PhysicsStepParams*, size_t, size_t);
+
+typedef struct {
+    IntegrateFn     fn;
+    const char*     name;
+} KernelEntry;
+
+static KernelEntry      s_kernel;
+static pthread_once_t   s_kernel_once = PTHREAD_ONCE_INIT;
+
+static void _integrate_vec4(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end);
+#if HAS_VEC8_KERNEL
+static void _integrate_vec8(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end);
+#endif
+static int _cpu_supports(const PhysicsKernel kernel);
+static void _set_kernel(const PhysicsKernel kernel);
+static void _select_default_kernel(void);
+
+void physics_integrate(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end) {
+    pthread_once(&s_kernel_once, _select_default_kernel);
+    s_kernel.fn(bodies, params, begin, end);
+}
+
+void physics_integrate_scalar(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end) {
+    const float delta_time = params->delta_time;
+
+    for (size_t i = begin; i < end; ++i) {
+        const float radius = bodies->radius[i];
+        Vec2 velocity = {
+            .x = bodies->velocity_x[i],
+            .y = bodies->velocity_y[i],
+        };
+
+        // modify velocity based on gravity and drag
+        velocity.y += params->gravity * bodies->mass[i] * delta_time;
+
+        Vec2 drag = vec2_invert(velocity);
+        drag = vec2_mul(drag, params->drag_coefficient);
+
+        velocity = vec2_add(velocity, drag);
+
+        Vec2 new_pos = {
+            .x = bodies->x[i] + (velocity.x * delta_time),
+            .y = bodies->y[i] + (velocity.y * delta_time),
+        };
+
+        const Vec2 max_bound = {
+            .x = params->bounds.x - radius,
+            .y = params->bounds.y - radius,
+        };
+        const Vec2 min_bound = {
+            .x = radius,
+            .y = radius,
+        };
+
+        if (new_pos.x > max_bound.x) {
+            velocity.x *= -1;
+            new_pos.x = max_bound.x;
+        } else if (new_pos.x < min_bound.x) {
+            velocity.x *= -1;
+            new_pos.x = min_bound.x;
+        }
+
+        if (new_pos.y > max_bound.y) {
+            velocity.y *= -1;
+            new_pos.y = max_bound.y;
+        } else if (new_pos.y < min_bound.y) {
+            velocity.y *= -1;
+            new_pos.y = min_bound.y;
+        }
+
+        bodies->x[i] = new_pos.x;
+        bodies->y[i] = new_pos.y;
+        bodies->velocity_x[i] = velocity.x;
+        bodies->velocity_y[i] = velocity.y;
+    }
+}
+
+int physics_kernel_select(const PhysicsKernel kernel) {
+    pthread_once(&s_kernel_once, _select_default_kernel);
+
+    if (! _cpu_supports(kernel))
+        return 0;
+
+    _set_kernel(kernel);
+    return 1;
+}
+
+const char* physics_kernel_name(void) {
+    pthread_once(&s_kernel_once, _select_default_kernel);
+    return s_kernel.name;
+}
+
+// the batched kernels are written once against the compiler's generic vector
+// extensions and stamped out per width, which lowers to SSE/AVX on x86 and
+// NEON on arm. walls are handled with compare masks instead of branches: a
+// body outside a wall gets its position replaced by the bound and the sign
+// bit of its velocity flipped, exactly like the scalar path. any tail that
+// doesn't fill a whole batch goes through the scalar kernel.
+#define DEFINE_BATCH_KERNEL(name, lanes, attributes)                                            \
+    typedef float name##_vf __attribute__((vector_size(lanes * sizeof(float))));               \
+    typedef int32_t name##_vi __attribute__((vector_size(lanes * sizeof(int32_t))));           \
+                                                                                                \
+    attributes static void name(const PhysicsBodies* bodies, const PhysicsStepParams* params,  \
+                                size_t begin, size_t end) {                                     \
+        const name##_vf delta_time  = (name##_vf){ 0 } + params->delta_time;                   \
+        const name##_vf gravity     = (name##_vf){ 0 } + params->gravity;                      \
+        const name##_vf drag        = (name##_vf){ 0 } + params->drag_coefficient;             \
+        const name##_vf bound_x     = (name##_vf){ 0 } + params->bounds.x;                     \
+        const name##_vf bound_y     = (name##_vf){ 0 } + params->bounds.y;                     \
+        const name##_vi sign_bit    = (name##_vi){ 0 } + INT32_MIN;                            \
+                                                                                                \
+        size_t i = begin;                                                                       \
+        for (; i + lanes <= end; i += lanes) {                                                  \
+            name##_vf x, y, vx, vy, mass, radius;                                               \
+            memcpy(&x, &bodies->x[i], sizeof(x));                                               \
+            memcpy(&y, &bodies->y[i], sizeof(y));                                               \
+            memcpy(&vx, &bodies->velocity_x[i], sizeof(vx));                                    \
+            memcpy(&vy, &bodies->velocity_y[i], sizeof(vy));                                    \
+            memcpy(&mass, &bodies->mass[i], sizeof(mass));                                      \
+            memcpy(&radius, &bodies->radius[i], sizeof(radius));                                \
+                                                                                                \
+            vy += gravity * mass * delta_time;                                                  \
+            vx += (vx * -1.f) * drag;                                                           \
+            vy += (vy * -1.f) * drag;                                                           \
+                                                                                                \
+            name##_vf nx = x + (vx * delta_time);                                               \
+            name##_vf ny = y + (vy * delta_time);                                               \
+            const name##_vf max_x = bound_x - radius;                                           \
+            const name##_vf max_y = bound_y - radius;                                           \
+                                                                                                \
+            const name##_vi over_x  = nx > max_x;                                               \
+            const name##_vi under_x = (nx < radius) & ~over_x;                                  \
+            const name##_vi over_y  = ny > max_y;                                               \
+            const name##_vi under_y = (ny < radius) & ~over_y;                                  \
+                                                                                                \
+            nx = (name##_vf)(((name##_vi)nx & ~(over_x | under_x))                              \
+                | ((name##_vi)max_x & over_x) | ((name##_vi)radius & under_x));                 \
+            ny = (name##_vf)(((name##_vi)ny & ~(over_y | under_y))                              \
+                | ((name##_vi)max_y & over_y) | ((name##_vi)radius & under_y));                 \
+            vx = (name##_vf)((name##_vi)vx ^ ((over_x | under_x) & sign_bit));                  \
+            vy = (name##_vf)((name##_vi)vy ^ ((over_y | under_y) & sign_bit));                  \
+                                                                                                \
+            memcpy(&bodies->x[i], &nx, sizeof(nx));                                             \
+            memcpy(&bodies->y[i], &ny, sizeof(ny));                                             \
+            memcpy(&bodies->velocity_x[i], &vx, sizeof(vx));                                    \
+            memcpy(&bodies->velocity_y[i], &vy, sizeof(vy));                                    \
+        }                                                                                       \
+                                                                                                \
+        physics_integrate_scalar(bodies, params, i, end);                                       \
+    }
+
+DEFINE_BATCH_KERNEL(_integrate_vec4, 4, )
+#if HAS_VEC8_KERNEL
+DEFINE_BATCH_KERNEL(_integrate_vec8, 8, VEC8_TARGET)
+#endif
+
+static int _cpu_supports(const PhysicsKernel kernel) {
+    switch (kernel) {
+        case PHYSICS_KERNEL_AUTO:
+        case PHYSICS_KERNEL_SCALAR:
+        case PHYSICS_KERNEL_VEC4:
+            return 1;
+        case PHYSICS_KERNEL_VEC8:
+#if HAS_VEC8_KERNEL
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx");
+#else
+            return 0;
+#endif
+    }
+
+    return 0;
+}
+
+static void _set_kernel(const PhysicsKernel kernel) {
+    switch (kernel) {
+        case PHYSICS_KERNEL_AUTO:
+            _select_default_kernel();
+            break;
+        case PHYSICS_KERNEL_SCALAR:
+            s_kernel = (KernelEntry) { physics_integrate_scalar, "scalar" };
+            break;
+        case PHYSICS_KERNEL_VEC4:
+            s_kernel = (KernelEntry) { _integrate_vec4, "vec4" };
+            break;
+        case PHYSICS_KERNEL_VEC8:
+#if HAS_VEC8_KERNEL
+            s_kernel = (KernelEntry) { _integrate_vec8, "vec8 (avx)" };
+#endif
+            break;
+    }
+}
+
+static void _select_default_kernel(void) {
+    _set_kernel(_cpu_supports(PHYSICS_KERNEL_VEC8) ? PHYSICS_KERNEL_VEC8 : PHYSICS_KERNEL_VEC4);
+}
@@ -0,0 +1,44 @@
+#ifndef PHYSICS_KERNEL_H
+#define PHYSICS_KERNEL_H
+
+#include <stdlib.h>
+
+#include "ecs.h"
+
+// a set of bodies laid out as parallel columns, body i at index i of each
+typedef struct {
+    float*          x;
+    float*          y;
+    float*          velocity_x;
+    float*          velocity_y;
+    const float*    mass;
+    const float*    radius;
+    size_t          count;
+} PhysicsBodies;
+
+typedef struct {
+    float   delta_time;
+    float   gravity;
+    float   drag_coefficient;
+    Vec2    bounds;
+} PhysicsStepParams;
+
+typedef enum {
+    PHYSICS_KERNEL_AUTO = 0,
+    PHYSICS_KERNEL_SCALAR,
+    PHYSICS_KERNEL_VEC4,
+    PHYSICS_KERNEL_VEC8,
+} PhysicsKernel;
+
+// applies gravity, drag, integration and wall reflection to bodies [begin, end)
+void physics_integrate(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end);
+
+// the reference implementation every batched kernel has to agree with
+void physics_integrate_scalar(const PhysicsBodies* bodies, const PhysicsStepParams* params, size_t begin, size_t end);
+
+// picks the kernel physics_integrate dispatches to. PHYSICS_KERNEL_AUTO picks
+// the widest one the cpu supports. returns 0 if the cpu can't run the kernel.
+int physics_kernel_select(const PhysicsKernel kernel);
+const char* physics_kernel_name(void);
+
+#endif // #ifndef PHYSICS_KERNEL_H
@@ -2,31 +2,97 @@
 
 #include <stdio.h>
 #include <pthread.h>
-#include <pthread/sched.h>
 #include <stdatomic.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <time.h>
 #include <stdint.h>
 
 #include "systems.h"
 #include "ecs.h"
+#include "thread_pool.h"
+#include "render_snapshot.h"
+#include "collision.h"
+#include "profiler.h"
+#include "lock_stats.h"
+#include "command_buffer.h"
+#include "scheduler.h"
 
-#define PHYSICS_STEPS_PER_SECOND 60
-#define MS_PER_PHYSICS_STEP 1000 / PHYSICS_STEPS_PER_SECOND
-#define US_PER_PHYSICS_STEP MS_PER_PHYSICS_STEP * 1000
+#define NS_PER_SECOND 1000000000ull
+
+// grouping the bodies reorders all three pools, so both physics systems
+// write to every pool they group
+#define PHYSICS_BODY_COMPONENTS (COMPONENT_POSITION | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER)
 
 static pthread_t s_thread;
+static PhysicsThreadConfig s_config;
+static ThreadPool* s_pool = NULL;
+static CollisionGrid* s_collision_grid = NULL;
+static CollisionStats s_collision_stats;
+static CollisionStats s_step_collision_stats;  // owned by the physics thread
+static Scheduler* s_scheduler = NULL;
+static PhysicsTimingStats s_timing_stats;
+static pthread_mutex_t s_stats_lock = PTHREAD_MUTEX_INITIALIZER;
 static atomic_int s_app_running = 1;
+static _Atomic uint64_t s_step_ns = NS_PER_SECOND / 60;
 
 static void* _physics_thread(void* args);
-static uint64_t _timeval_to_timestamp_ms(struct timeval tv);
-static uint32_t _get_diff_us(struct timeval start, struct timeval end);
+static int _register_systems(void);
+static void _run_collision(EcsWorld* world, void* context, const float delta_time);
+static void _run_physics(EcsWorld* world, void* context, const float delta_time);
+static void _step(const float delta_time, const uint64_t step);
+static uint64_t _now_ns(void);
+static void _sleep_until_ns(uint64_t deadline_ns);
+
+int start_physics_thread(const PhysicsThreadConfig* config) {
+    if (config->world == NULL || config->commands == NULL) {
+        fprintf(stderr, "ERROR: physics thread needs a world and a command queue\n");
+        return 0;
+    }
+
+    s_config = *config;
+    if (s_config.max_catch_up_steps == 0)
+        s_config.max_catch_up_steps = 1;
+
+    memset(&s_timing_stats, 0, sizeof(s_timing_stats));
+    physics_thread_set_step_rate(s_config.steps_per_second);
+
+    s_pool = thread_pool_create(s_config.worker_count);
+    if (s_pool == NULL) {
+        fprintf(stderr, "ERROR: failed to create physics worker pool\n");
+        return 0;
+    }
+
+    s_collision_grid = collision_grid_create();
+    if (s_collision_grid == NULL) {
+        fprintf(stderr, "ERROR: failed to create collision grid\n");
+        thread_pool_destroy(s_pool);
+        s_pool = NULL;
+        return 0;
+    }
+
+    s_scheduler = scheduler_create(s_pool);
+    if (s_scheduler == NULL || ! _register_systems()) {
+        fprintf(stderr, "ERROR: failed to set up the physics systems\n");
+        scheduler_destroy(s_scheduler);
+        s_scheduler = NULL;
+        collision_grid_destroy(s_collision_grid);
+        s_collision_grid = NULL;
+        thread_pool_destroy(s_pool);
+        s_pool = NULL;
+        return 0;
+    }
 
-int start_physics_thread(void) {
+    s_app_running = 1;
     const int err = pthread_create(&s_thread, NULL, _physics_thread, NULL);
     if (err != 0) {
         fprintf(stderr, "ERROR: failed to start physics thread (%s)\n", strerror(err));
+        scheduler_destroy(s_scheduler);
+        s_scheduler = NULL;
+        collision_grid_destroy(s_collision_grid);
+        s_collision_grid = NULL;
+        thread_pool_destroy(s_pool);
+        s_pool = NULL;
         return 0;
     }
 
@@ -38,67 +104,203 @@ void join_physics_thread(void) {
     const int err = pthread_join(s_thread, NULL);
     if (err != 0)
         fprintf(stderr, "ERROR: failed to join physics thread (%s)\n", strerror(err));
+
+    scheduler_destroy(s_scheduler);
+    s_scheduler = NULL;
+    collision_grid_destroy(s_collision_grid);
+    s_collision_grid = NULL;
+    thread_pool_destroy(s_pool);
+    s_pool = NULL;
+}
+
+void physics_thread_set_step_rate(const double steps_per_second) {
+    if (steps_per_second <= 0.0) {
+        fprintf(stderr, "ERROR: invalid physics step rate %f\n", steps_per_second);
+        return;
+    }
+
+    s_step_ns = (uint64_t)(NS_PER_SECOND / steps_per_second);
+}
+
+void physics_thread_get_collision_stats(CollisionStats* o_stats) {
+    pthread_mutex_lock(&s_stats_lock);
+    *o_stats = s_collision_stats;
+    pthread_mutex_unlock(&s_stats_lock);
 }
 
+void physics_thread_get_timing_stats(PhysicsTimingStats* o_stats) {
+    pthread_mutex_lock(&s_stats_lock);
+    *o_stats = s_timing_stats;
+    pthread_mutex_unlock(&s_stats_lock);
+}
+
+// fixed timestep: real time is banked in an accumulator and paid out in
+// whole steps of exactly step_ns, so the simulation advances the same way no
+// matter how late the thread wakes. between ticks it sleeps until the
+// absolute moment the next step falls due, so time spent stepping doesn't
+// push the schedule back.
 static void* _physics_thread(void* args) {
     (void)args;
 
-    struct timeval thread_start;
-    gettimeofday(&thread_start, NULL);
-    uint64_t last_step_ms = _timeval_to_timestamp_ms(thread_start);
+    PROFILE_THREAD_NAME("physics");
+    LOCK_STATS_THREAD_NAME("physics");
+
+    uint64_t last_tick_ns = _now_ns();
+    uint64_t deadline_ns = last_tick_ns;
+    uint64_t accumulator_ns = 0;
 
     while (s_app_running) {
-        ecs_lock_mutex();
+        const uint64_t step_ns = s_step_ns;
+        const uint64_t tick_ns = _now_ns();
+        const uint64_t jitter_ns = tick_ns > deadline_ns ? tick_ns - deadline_ns : 0;
+
+        accumulator_ns += tick_ns - last_tick_ns;
+        last_tick_ns = tick_ns;
+
+        const float delta_time = (float)((double)step_ns / NS_PER_SECOND);
+        const uint64_t steps_owed = accumulator_ns / step_ns;
+
+        uint32_t steps_run = 0;
+        uint64_t max_step_ns = 0;
 
-        struct timeval step_start;
-        gettimeofday(&step_start, NULL);
+        while (accumulator_ns >= step_ns && steps_run < s_config.max_catch_up_steps) {
+            const uint64_t step_start_ns = _now_ns();
+            _step(delta_time, s_timing_stats.steps + steps_run + 1);
+            const uint64_t step_time_ns = _now_ns() - step_start_ns;
 
-        const uint64_t step_start_ms = _timeval_to_timestamp_ms(step_start);
-        const float step_diff_ms = step_start_ms - last_step_ms;
+            if (step_time_ns > max_step_ns)
+                max_step_ns = step_time_ns;
 
-        const float delta_time = step_diff_ms / 1000.f;
-        system_physics(delta_time);
+            accumulator_ns -= step_ns;
+            steps_run++;
+        }
 
-        last_step_ms = step_start_ms;
+        // anything still owed past the catch up limit is dropped, keeping
+        // only the partial step so the phase of the schedule is preserved
+        uint64_t dropped_steps = 0;
+        if (accumulator_ns >= step_ns) {
+            dropped_steps = accumulator_ns / step_ns;
+            accumulator_ns %= step_ns;
+        }
 
-        ecs_unlock_mutex();
-        sched_yield();
+        uint64_t extract_ns = 0;
+        if (steps_run > 0) {
+            RenderSnapshot* snapshot = render_snapshot_begin_write();
+            ecs_lock_mutex(s_config.world);
+            const uint64_t extract_start_ns = _now_ns();
+            system_extract_render_snapshot(s_config.world, snapshot);
+            extract_ns = _now_ns() - extract_start_ns;
+            ecs_unlock_mutex(s_config.world);
+            snapshot->step = s_timing_stats.steps + steps_run;
+            render_snapshot_publish();
+        }
 
-        struct timeval step_end;
-        gettimeofday(&step_end, NULL);
+        pthread_mutex_lock(&s_stats_lock);
+        PhysicsTimingStats* stats = &s_timing_stats;
+        stats->ticks++;
+        stats->steps += steps_run;
+        stats->dropped_steps += dropped_steps;
+        if (steps_owed > 1)
+            stats->overruns++;
 
-        const uint32_t time_taken_us = _get_diff_us(step_start, step_end);
-        const uint32_t us_to_sleep = US_PER_PHYSICS_STEP - time_taken_us;
+        stats->last_jitter_ns = jitter_ns;
+        if (jitter_ns > stats->max_jitter_ns)
+            stats->max_jitter_ns = jitter_ns;
+        stats->mean_jitter_ns += (jitter_ns - stats->mean_jitter_ns) / stats->ticks;
 
-        usleep(us_to_sleep);
+        if (steps_run > 0) {
+            stats->last_step_ns = max_step_ns;
+            if (max_step_ns > stats->max_step_ns)
+                stats->max_step_ns = max_step_ns;
+
+            stats->last_extract_ns = extract_ns;
+            if (extract_ns > stats->max_extract_ns)
+                stats->max_extract_ns = extract_ns;
+
+            s_collision_stats = s_step_collision_stats;
+        }
+        pthread_mutex_unlock(&s_stats_lock);
+
+        deadline_ns = last_tick_ns + (step_ns - accumulator_ns);
+        _sleep_until_ns(deadline_ns);
     }
 
     return NULL;
 }
 
-static uint64_t _timeval_to_timestamp_ms(struct timeval tv) {
-    const uint64_t secs = tv.tv_sec;
-    const uint64_t msecs = tv.tv_usec / 1000;
+static int _register_systems(void) {
+    // resolve contacts first so the walls get the final say on position.
+    // the two conflict, so the scheduler keeps them in this order
+    const SystemDesc collision = {
+        .name       = "collision",
+        .run        = _run_collision,
+        .reads      = PHYSICS_BODY_COMPONENTS,
+        .writes     = PHYSICS_BODY_COMPONENTS,
+    };
+    const SystemDesc physics = {
+        .name       = "physics",
+        .run        = _run_physics,
+        .reads      = PHYSICS_BODY_COMPONENTS,
+        .writes     = PHYSICS_BODY_COMPONENTS,
+    };
 
-    return (secs * 1000) + msecs;
+    return scheduler_add_system(s_scheduler, &collision)
+        && scheduler_add_system(s_scheduler, &physics);
 }
 
-static uint32_t _get_diff_us(struct timeval start, struct timeval end) {
-    const uint32_t start_ms = start.tv_sec / 1000;
-    const uint32_t end_ms   = end.tv_sec / 1000;
-    const uint32_t start_us = start.tv_usec;
-    const uint32_t end_us   = start.tv_usec;
-
-    uint32_t diff_ms = end_ms - start_ms;
-    uint32_t diff_us = 0;
-    if (end_us < start_us) {
-        const uint32_t overflow = start_us - end_us;
-        diff_us = 1000 - overflow;
-        diff_ms += 1;
-    } else {
-        diff_us = end_us - start_us;
-    }
+static void _run_collision(EcsWorld* world, void* context, const float delta_time) {
+    (void)context;
+    (void)delta_time;
+    system_collision(world, s_pool, s_collision_grid, &s_step_collision_stats);
+}
 
-    return diff_us + (diff_ms * 1000);
+static void _run_physics(EcsWorld* world, void* context, const float delta_time) {
+    (void)context;
+    system_physics(world, s_pool, delta_time, s_config.bounds);
 }
 
+static void _step(const float delta_time, const uint64_t step) {
+    PROFILE_SCOPE("physics_step");
+
+    EcsWorld* world = s_config.world;
+    ecs_lock_mutex(world);
+
+    // structural changes queued by other threads land between steps, never
+    // in the middle of one
+    command_queue_apply(s_config.commands, world);
+    scheduler_run(s_scheduler, world, delta_time);
+
+    // only copies the columns out, the recorder's own thread does the rest
+    if (s_config.recorder != NULL)
+        recorder_capture(s_config.recorder, world, step);
+
+    ecs_unlock_mutex(world);
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NS_PER_SECOND) + (uint64_t)ts.tv_nsec;
+}
+
+static void _sleep_until_ns(uint64_t deadline_ns) {
+#if defined(__APPLE__)
+    // no clock_nanosleep on macos, so fall back to a relative sleep
+    const uint64_t now_ns = _now_ns();
+    if (deadline_ns <= now_ns)
+        return;
+
+    const uint64_t sleep_ns = deadline_ns - now_ns;
+    struct timespec ts = {
+        .tv_sec = sleep_ns / NS_PER_SECOND,
+        .tv_nsec = sleep_ns % NS_PER_SECOND,
+    };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+#else
+    const struct timespec ts = {
+        .tv_sec = deadline_ns / NS_PER_SECOND,
+        .tv_nsec = deadline_ns % NS_PER_SECOND,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#endif
+}
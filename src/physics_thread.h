@@ -1,8 +1,56 @@
 #ifndef PHYSICS_THREAD_H
 #define PHYSICS_THREAD_H
 
-int start_physics_thread(void);
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "ecs.h"
+#include "collision.h"
+#include "command_buffer.h"
+#include "recording.h"
+
+#define DEFAULT_PHYSICS_STEPS_PER_SECOND 60.0
+
+// steps run back to back to catch up after a stall before the remaining time
+// is dropped. without a limit a slow step makes the next tick owe even more
+// steps, and the simulation never recovers.
+#define DEFAULT_PHYSICS_MAX_CATCH_UP_STEPS 5
+
+// the thread steps world and applies commands submitted to the queue between
+// steps. both belong to the caller and have to outlive the thread, as does
+// the recorder if there is one.
+typedef struct {
+    EcsWorld*       world;
+    CommandQueue*   commands;
+    Recorder*       recorder;           // optional, captures every step
+    double          steps_per_second;
+    uint32_t        max_catch_up_steps;
+    size_t          worker_count;       // extra threads sharing each step
+    Vec2            bounds;             // bodies are kept inside [0, bounds]
+} PhysicsThreadConfig;
+
+typedef struct {
+    uint64_t    steps;
+    uint64_t    ticks;              // wake ups, each running zero or more steps
+    uint64_t    overruns;           // ticks that owed more than one step
+    uint64_t    dropped_steps;      // steps given up by the catch up limit
+    uint64_t    last_jitter_ns;     // how late the thread woke past its deadline
+    uint64_t    max_jitter_ns;
+    double      mean_jitter_ns;
+    uint64_t    last_step_ns;
+    uint64_t    max_step_ns;
+    uint64_t    last_extract_ns;    // packing the draw list, under the world lock
+    uint64_t    max_extract_ns;
+} PhysicsTimingStats;
+
+int start_physics_thread(const PhysicsThreadConfig* config);
 void join_physics_thread(void);
 
-#endif // #ifndef PHYSICS_THREAD_H
+// takes effect from the next tick
+void physics_thread_set_step_rate(const double steps_per_second);
 
+// figures from the most recently completed step
+void physics_thread_get_collision_stats(CollisionStats* o_stats);
+void physics_thread_get_timing_stats(PhysicsTimingStats* o_stats);
+
+#endif // #ifndef PHYSICS_THREAD_H
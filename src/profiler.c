@@ -0,0 +1,135 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// per thread, so roughly 1.5MB each. once full the oldest events are overwritten
+#define EVENTS_PER_THREAD (1 << 16)
+
+typedef struct {
+    const char* name;
+    uint64_t    start_ns;
+    uint64_t    duration_ns;
+} ProfileEvent;
+
+// only ever written by the thread that owns it. `written` is published with
+// release ordering so a dump sees every event before the count it reads.
+typedef struct ThreadBuffer {
+    struct ThreadBuffer*    next;
+    uint32_t                thread_id;
+    const char*             thread_name;
+    atomic_size_t           written;
+    ProfileEvent            events[EVENTS_PER_THREAD];
+} ThreadBuffer;
+
+static _Atomic(ThreadBuffer*)   s_buffers = NULL;
+static atomic_uint              s_next_thread_id = 1;
+static _Thread_local ThreadBuffer* t_buffer = NULL;
+
+static ThreadBuffer* _get_thread_buffer(void);
+static uint64_t _now_ns(void);
+
+ProfileScope profiler_scope_begin(const char* name) {
+    return (ProfileScope) {
+        .name = name,
+        .start_ns = _now_ns(),
+    };
+}
+
+void profiler_scope_end(ProfileScope* scope) {
+    const uint64_t end_ns = _now_ns();
+
+    ThreadBuffer* buffer = _get_thread_buffer();
+    if (buffer == NULL)
+        return;
+
+    const size_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+    buffer->events[written % EVENTS_PER_THREAD] = (ProfileEvent) {
+        .name           = scope->name,
+        .start_ns       = scope->start_ns,
+        .duration_ns    = end_ns - scope->start_ns,
+    };
+    atomic_store_explicit(&buffer->written, written + 1, memory_order_release);
+}
+
+void profiler_set_thread_name(const char* name) {
+    ThreadBuffer* buffer = _get_thread_buffer();
+    if (buffer != NULL)
+        buffer->thread_name = name;
+}
+
+int profiler_dump_chrome_trace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: failed to open trace file %s\n", path);
+        return 0;
+    }
+
+    // timestamps are rebased on the earliest start so they stay readable.
+    // events are written as their scope ends, so an enclosing scope comes
+    // after the ones inside it and every event has to be looked at
+    uint64_t epoch_ns = UINT64_MAX;
+    for (ThreadBuffer* buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+        const size_t written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+        const size_t first = written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+        for (size_t i = first; i < written; ++i) {
+            if (buffer->events[i % EVENTS_PER_THREAD].start_ns < epoch_ns)
+                epoch_ns = buffer->events[i % EVENTS_PER_THREAD].start_ns;
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    int first_event = 1;
+    for (ThreadBuffer* buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+        if (buffer->thread_name != NULL) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first_event ? "" : ",\n", buffer->thread_id, buffer->thread_name);
+            first_event = 0;
+        }
+
+        const size_t written = atomic_load_explicit(&buffer->written, memory_order_acquire);
+        const size_t first = written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+        for (size_t i = first; i < written; ++i) {
+            const ProfileEvent* event = &buffer->events[i % EVENTS_PER_THREAD];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                first_event ? "" : ",\n", event->name, buffer->thread_id,
+                ((int64_t)event->start_ns - (int64_t)epoch_ns) / 1000.0, event->duration_ns / 1000.0);
+            first_event = 0;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 1;
+}
+
+static ThreadBuffer* _get_thread_buffer(void) {
+    if (t_buffer != NULL)
+        return t_buffer;
+
+    ThreadBuffer* buffer = calloc(1, sizeof(ThreadBuffer));
+    if (buffer == NULL)
+        return NULL;
+
+    buffer->thread_id = atomic_fetch_add(&s_next_thread_id, 1);
+
+    // buffers live until the process exits, so a dump never has to worry
+    // about a thread that has already gone away
+    ThreadBuffer* head = atomic_load(&s_buffers);
+    do {
+        buffer->next = head;
+    } while (! atomic_compare_exchange_weak(&s_buffers, &head, buffer));
+
+    t_buffer = buffer;
+    return buffer;
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
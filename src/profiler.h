@@ -0,0 +1,46 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+// scoped timing events, written into a ring buffer per thread and dumped as a
+// chrome trace (load it in about:tracing or ui.perfetto.dev). build with
+// ECS_ENABLE_PROFILER to turn it on; otherwise every macro compiles away.
+//
+//     void system_foo(void) {
+//         PROFILE_SCOPE("system_foo");
+//         ...
+//     }
+
+typedef struct {
+    const char* name;
+    uint64_t    start_ns;
+} ProfileScope;
+
+// names must be string literals, or otherwise outlive the profiler
+ProfileScope profiler_scope_begin(const char* name);
+void profiler_scope_end(ProfileScope* scope);
+void profiler_set_thread_name(const char* name);
+int profiler_dump_chrome_trace(const char* path);
+
+#ifdef ECS_ENABLE_PROFILER
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(name)                                                     \
+    ProfileScope PROFILE_CONCAT(_profile_scope_, __LINE__)                      \
+        __attribute__((cleanup(profiler_scope_end))) = profiler_scope_begin(name)
+
+#define PROFILE_THREAD_NAME(name)   profiler_set_thread_name(name)
+#define PROFILE_DUMP(path)          profiler_dump_chrome_trace(path)
+
+#else
+
+#define PROFILE_SCOPE(name)         ((void)0)
+#define PROFILE_THREAD_NAME(name)   ((void)0)
+#define PROFILE_DUMP(path)          ((void)0)
+
+#endif // #ifdef ECS_ENABLE_PROFILER
+
+#endif // #ifndef PROFILER_H
@@ -0,0 +1,1021 @@
+#include "recording.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "profiler.h"
+
+#define RECORDING_MAGIC "CECSREC"
+#define RECORDING_VERSION 1
+#define RECORDING_ENDIAN_MARK 0x01020304u
+
+// every entry in a frame starts with a tag. the low bits say what the entry
+// holds and the rest is how far its entity's index is past the entry before's
+#define ENTRY_KIND_BITS 2
+#define ENTRY_KIND_MASK ((1u << ENTRY_KIND_BITS) - 1)
+#define ENTRY_UPDATE    0   // quantized deltas of an entity seen last frame
+#define ENTRY_FULL      1   // everything about a new entity, or one whose display changed
+#define ENTRY_DESPAWN   2
+
+#define ENTRY_FLAG_DISPLAY 0x1u
+
+// the most any one entry can take up, varints included
+#define MAX_VARINT_SIZE 10
+#define MAX_ENTRY_SIZE ((MAX_VARINT_SIZE * 6) + 1 + sizeof(float) + sizeof(Color))
+
+// frames bigger than this are taken to be corrupt
+#define MAX_FRAME_SIZE ((uint64_t)1 << 31)
+
+// quantized x, y, velocity x and velocity y
+#define QUANTIZED_COUNT 4
+
+// pools captured from the world, each as its owners plus two 4 byte columns
+typedef enum {
+    CAPTURE_POSITION = 0,
+    CAPTURE_RIGID_BODY,
+    CAPTURE_DISPLAY,
+    CAPTURE_COUNT,
+} CaptureType;
+
+#define CAPTURED_VALUE_SIZE 4
+_Static_assert(sizeof(float) == CAPTURED_VALUE_SIZE && sizeof(Color) == CAPTURED_VALUE_SIZE,
+    "captured columns are copied as 4 byte values");
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    endian_mark;
+    float       quantum;
+    uint32_t    reserved;
+} RecordingHeader;
+
+// the components of a pool written since the capture before, and the slots
+// they were written to
+typedef struct {
+    uint32_t*   slots;
+    EntityID*   owners;
+    void*       values[2];
+    size_t      count;
+    size_t      capacity;
+    size_t      pool_count;     // components in the whole pool
+} CapturedPool;
+
+// the writer thread's copy of a whole pool, brought up to date with each
+// captured frame
+typedef struct {
+    EntityID*   owners;
+    void*       values[2];
+    size_t      count;
+    size_t      capacity;
+} MirroredPool;
+
+typedef struct {
+    uint64_t        step;
+    CapturedPool    pools[CAPTURE_COUNT];
+} CapturedFrame;
+
+// what the other end of the stream knows about each entity index
+typedef struct {
+    EntityID    id;                     // 0 when no entity had the index
+    int32_t     q[QUANTIZED_COUNT];
+    float       radius;
+    Color       color;
+    uint8_t     flags;
+} EntityState;
+
+typedef struct {
+    uint8_t*    data;
+    size_t      size;
+    size_t      capacity;
+} ByteBuffer;
+
+struct Recorder {
+    // the ring is single producer, single consumer. head is only written by
+    // the capturing thread and tail only by the writer thread, each on its
+    // own cache line
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) _Atomic size_t tail;
+
+    _Alignas(64) CapturedFrame* ring;
+    size_t              ring_frames;
+    float               quantum;
+    EcsVersion          since;          // owned by the capturing thread
+
+    pthread_t           thread;
+    pthread_mutex_t     wake_lock;
+    pthread_cond_t      wake;
+    int                 running;        // guarded by wake_lock
+
+    // owned by the writer thread. slots holds slot + 1 of each index's
+    // component in the mirrored pools, 0 if absent, and dirty has a bit for
+    // every index whose components were captured since the frame before
+    FILE*               file;
+    EntityState*        states;
+    MirroredPool        pools[CAPTURE_COUNT];
+    size_t*             slots[CAPTURE_COUNT];
+    uint64_t*           dirty;
+    size_t              state_capacity;
+    size_t              state_end;
+    ByteBuffer          entries;
+    int                 failed;
+
+    _Atomic uint64_t    frames_written;
+    _Atomic uint64_t    frames_dropped;
+    _Atomic uint64_t    bytes_written;
+    _Atomic uint64_t    components_captured;
+};
+
+struct Replay {
+    FILE*           file;
+    float           quantum;
+    EntityState*    states;
+    size_t          state_capacity;
+    size_t          state_end;
+    ByteBuffer      payload;
+
+    // the decoded frame handed out to the caller
+    EntityID*       ids;
+    float*          x;
+    float*          y;
+    float*          velocity_x;
+    float*          velocity_y;
+    float*          radius;
+    Color*          color;
+    uint8_t*        has_display;
+    size_t          frame_capacity;
+};
+
+static void* _writer_thread(void* args);
+static int _capture_pool(CapturedPool* pool, const EcsWorld* world, const ComponentType type, const EcsVersion since,
+    const EntityID* owners, const void* a, const void* b, const size_t count);
+static void _free_captured_frame(CapturedFrame* frame);
+static int _apply_captured_pool(Recorder* recorder, const size_t type, const CapturedPool* captured);
+static void _release_slot(Recorder* recorder, const size_t type, const size_t slot);
+static int _encode_frame(Recorder* recorder, const CapturedFrame* frame);
+static int _grow_states(EntityState** states, size_t* capacity, const size_t min_capacity);
+static int _grow_recorder_slots(Recorder* recorder, const size_t old_capacity, const size_t new_capacity);
+static int _reserve_bytes(ByteBuffer* buffer, const size_t size);
+static int _grow_replay_frame(Replay* replay, const size_t min_capacity);
+static int32_t _quantize(const float value, const float inverse_quantum);
+static uint8_t* _put_varint(uint8_t* out, uint64_t value);
+static int _get_varint(const uint8_t** cursor, const uint8_t* end, uint64_t* o_value);
+static int _read_varint(FILE* file, uint64_t* o_value, int* o_eof);
+static uint64_t _zigzag(const int64_t value);
+static int64_t _unzigzag(const uint64_t value);
+
+Recorder* recorder_create(const char* path, const RecorderConfig* config) {
+    RecorderConfig recorder_config = {
+        .ring_frames    = DEFAULT_RECORDER_RING_FRAMES,
+        .quantum        = DEFAULT_RECORDER_QUANTUM,
+    };
+    if (config != NULL)
+        recorder_config = *config;
+
+    if (recorder_config.ring_frames == 0 || ! (recorder_config.quantum > 0.f)) {
+        fprintf(stderr, "ERROR: invalid recorder config\n");
+        return NULL;
+    }
+
+    Recorder* recorder = aligned_alloc(_Alignof(Recorder), sizeof(Recorder));
+    if (recorder == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate recorder\n");
+        return NULL;
+    }
+
+    memset(recorder, 0, sizeof(*recorder));
+    atomic_init(&recorder->head, 0);
+    atomic_init(&recorder->tail, 0);
+    atomic_init(&recorder->frames_written, 0);
+    atomic_init(&recorder->frames_dropped, 0);
+    atomic_init(&recorder->bytes_written, 0);
+    atomic_init(&recorder->components_captured, 0);
+    recorder->ring_frames = recorder_config.ring_frames;
+    recorder->quantum = recorder_config.quantum;
+    recorder->running = 1;
+
+    recorder->ring = calloc(recorder->ring_frames, sizeof(CapturedFrame));
+    recorder->file = fopen(path, "wb");
+    if (recorder->ring == NULL || recorder->file == NULL) {
+        fprintf(stderr, "ERROR: failed to open recording %s (%s)\n", path, strerror(errno));
+        if (recorder->file != NULL)
+            fclose(recorder->file);
+        free(recorder->ring);
+        free(recorder);
+        return NULL;
+    }
+
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.endian_mark = RECORDING_ENDIAN_MARK;
+    header.quantum = recorder->quantum;
+
+    int ok = fwrite(&header, sizeof(header), 1, recorder->file) == 1;
+    if (ok) {
+        pthread_mutex_init(&recorder->wake_lock, NULL);
+        pthread_cond_init(&recorder->wake, NULL);
+
+        const int err = pthread_create(&recorder->thread, NULL, _writer_thread, recorder);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: failed to start recorder thread (%s)\n", strerror(err));
+            pthread_cond_destroy(&recorder->wake);
+            pthread_mutex_destroy(&recorder->wake_lock);
+            ok = 0;
+        }
+    }
+
+    if (! ok) {
+        fclose(recorder->file);
+        free(recorder->ring);
+        free(recorder);
+        return NULL;
+    }
+
+    atomic_fetch_add(&recorder->bytes_written, sizeof(header));
+    return recorder;
+}
+
+void recorder_destroy(Recorder* recorder) {
+    if (recorder == NULL)
+        return;
+
+    pthread_mutex_lock(&recorder->wake_lock);
+    recorder->running = 0;
+    pthread_cond_signal(&recorder->wake);
+    pthread_mutex_unlock(&recorder->wake_lock);
+
+    const int err = pthread_join(recorder->thread, NULL);
+    if (err != 0)
+        fprintf(stderr, "ERROR: failed to join recorder thread (%s)\n", strerror(err));
+
+    if (fclose(recorder->file) != 0)
+        fprintf(stderr, "ERROR: failed to finish writing recording (%s)\n", strerror(errno));
+
+    for (size_t i = 0; i < recorder->ring_frames; ++i)
+        _free_captured_frame(&recorder->ring[i]);
+
+    for (size_t i = 0; i < CAPTURE_COUNT; ++i) {
+        free(recorder->pools[i].owners);
+        free(recorder->pools[i].values[0]);
+        free(recorder->pools[i].values[1]);
+        free(recorder->slots[i]);
+    }
+
+    free(recorder->dirty);
+    pthread_cond_destroy(&recorder->wake);
+    pthread_mutex_destroy(&recorder->wake_lock);
+    free(recorder->entries.data);
+    free(recorder->states);
+    free(recorder->ring);
+    free(recorder);
+}
+
+int recorder_capture(Recorder* recorder, EcsWorld* world, const uint64_t step) {
+    PROFILE_SCOPE("recorder_capture");
+
+    const size_t head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&recorder->tail, memory_order_acquire);
+    if (head - tail == recorder->ring_frames) {
+        atomic_fetch_add_explicit(&recorder->frames_dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    PositionColumns positions;
+    RigidBodyColumns bodies;
+    DisplayColumns displays;
+    ecs_get_position_columns(world, &positions);
+    ecs_get_rigid_body_columns(world, &bodies);
+    ecs_get_display_columns(world, &displays);
+
+    CapturedFrame* frame = &recorder->ring[head % recorder->ring_frames];
+    frame->step = step;
+
+    const EcsVersion since = recorder->since;
+    const int ok = _capture_pool(&frame->pools[CAPTURE_POSITION], world, COMPONENT_TYPE_POSITION, since,
+            positions.owners, positions.x, positions.y, positions.count)
+        && _capture_pool(&frame->pools[CAPTURE_RIGID_BODY], world, COMPONENT_TYPE_RIGID_BODY, since,
+            bodies.owners, bodies.velocity_x, bodies.velocity_y, bodies.count)
+        && _capture_pool(&frame->pools[CAPTURE_DISPLAY], world, COMPONENT_TYPE_DISPLAY, since,
+            displays.owners, displays.radius, displays.color, displays.count);
+
+    if (! ok) {
+        atomic_fetch_add_explicit(&recorder->frames_dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    // a dropped step leaves this where it was, so its writes are picked up by
+    // the next capture instead
+    recorder->since = ecs_change_tick(world);
+
+    size_t captured = 0;
+    for (size_t type = 0; type < CAPTURE_COUNT; ++type)
+        captured += frame->pools[type].count;
+
+    atomic_fetch_add_explicit(&recorder->components_captured, captured, memory_order_relaxed);
+
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+
+    pthread_mutex_lock(&recorder->wake_lock);
+    pthread_cond_signal(&recorder->wake);
+    pthread_mutex_unlock(&recorder->wake_lock);
+
+    return 1;
+}
+
+void recorder_get_stats(Recorder* recorder, RecorderStats* o_stats) {
+    o_stats->frames_written = atomic_load(&recorder->frames_written);
+    o_stats->frames_dropped = atomic_load(&recorder->frames_dropped);
+    o_stats->bytes_written = atomic_load(&recorder->bytes_written);
+    o_stats->components_captured = atomic_load(&recorder->components_captured);
+}
+
+Replay* replay_open(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: failed to open recording %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+
+    RecordingHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0
+        || header.version != RECORDING_VERSION
+        || header.endian_mark != RECORDING_ENDIAN_MARK
+        || ! (header.quantum > 0.f)) {
+        fprintf(stderr, "ERROR: %s isn't a recording this build can read\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    Replay* replay = calloc(1, sizeof(Replay));
+    if (replay == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate replay\n");
+        fclose(file);
+        return NULL;
+    }
+
+    replay->file = file;
+    replay->quantum = header.quantum;
+    return replay;
+}
+
+void replay_close(Replay* replay) {
+    if (replay == NULL)
+        return;
+
+    fclose(replay->file);
+    free(replay->states);
+    free(replay->payload.data);
+    free(replay->ids);
+    free(replay->x);
+    free(replay->y);
+    free(replay->velocity_x);
+    free(replay->velocity_y);
+    free(replay->radius);
+    free(replay->color);
+    free(replay->has_display);
+    free(replay);
+}
+
+int replay_next(Replay* replay, ReplayFrame* o_frame) {
+    PROFILE_SCOPE("replay_next");
+
+    uint64_t frame_size = 0;
+    int eof = 0;
+    if (! _read_varint(replay->file, &frame_size, &eof)) {
+        if (! eof)
+            fprintf(stderr, "ERROR: recording is truncated\n");
+        return 0;
+    }
+
+    if (frame_size > MAX_FRAME_SIZE || ! _reserve_bytes(&replay->payload, frame_size)
+        || fread(replay->payload.data, 1, frame_size, replay->file) != frame_size) {
+        fprintf(stderr, "ERROR: recording is truncated\n");
+        return 0;
+    }
+
+    const uint8_t* cursor = replay->payload.data;
+    const uint8_t* end = cursor + frame_size;
+
+    uint64_t step = 0;
+    uint64_t entry_count = 0;
+    int ok = _get_varint(&cursor, end, &step) && _get_varint(&cursor, end, &entry_count);
+
+    size_t index = 0;
+    for (uint64_t entry = 0; entry < entry_count && ok; ++entry) {
+        uint64_t tag = 0;
+        ok = _get_varint(&cursor, end, &tag);
+
+        const uint64_t gap = tag >> ENTRY_KIND_BITS;
+        ok = ok && gap > 0 && gap <= ECS_ENTITY_INDEX_MASK - index;
+        if (! ok)
+            break;
+
+        index += gap;
+        if (index >= replay->state_capacity)
+            ok = _grow_states(&replay->states, &replay->state_capacity, index + 1);
+
+        if (! ok)
+            break;
+
+        if (index >= replay->state_end)
+            replay->state_end = index + 1;
+
+        EntityState* state = &replay->states[index];
+        switch (tag & ENTRY_KIND_MASK) {
+            case ENTRY_UPDATE:
+                ok = state->id != INVALID_ENTITY_ID;
+                for (size_t i = 0; i < QUANTIZED_COUNT && ok; ++i) {
+                    uint64_t delta = 0;
+                    ok = _get_varint(&cursor, end, &delta);
+                    state->q[i] = (int32_t)(state->q[i] + _unzigzag(delta));
+                }
+                break;
+
+            case ENTRY_FULL: {
+                uint64_t generation = 0;
+                ok = _get_varint(&cursor, end, &generation) && generation <= ECS_ENTITY_GENERATION_MASK;
+                for (size_t i = 0; i < QUANTIZED_COUNT && ok; ++i) {
+                    uint64_t value = 0;
+                    ok = _get_varint(&cursor, end, &value);
+                    state->q[i] = (int32_t)_unzigzag(value);
+                }
+
+                ok = ok && cursor < end;
+                if (! ok)
+                    break;
+
+                state->id = ((EntityID)generation << ECS_ENTITY_INDEX_BITS) | (EntityID)index;
+                state->flags = *cursor++;
+                state->radius = 0.f;
+                memset(&state->color, 0, sizeof(state->color));
+                if (state->flags & ENTRY_FLAG_DISPLAY) {
+                    ok = (size_t)(end - cursor) >= sizeof(float) + sizeof(Color);
+                    if (ok) {
+                        memcpy(&state->radius, cursor, sizeof(float));
+                        memcpy(&state->color, cursor + sizeof(float), sizeof(Color));
+                        cursor += sizeof(float) + sizeof(Color);
+                    }
+                }
+                break;
+            }
+
+            case ENTRY_DESPAWN:
+                ok = state->id != INVALID_ENTITY_ID;
+                state->id = INVALID_ENTITY_ID;
+                break;
+
+            default:
+                ok = 0;
+                break;
+        }
+    }
+
+    if (! ok || cursor != end) {
+        fprintf(stderr, "ERROR: recording has a corrupt frame\n");
+        return 0;
+    }
+
+    // the frame handed out is rebuilt from scratch, as every entity's state
+    // may have moved
+    size_t count = 0;
+    for (size_t i = 1; i < replay->state_end; ++i)
+        count += replay->states[i].id != INVALID_ENTITY_ID;
+
+    if (! _grow_replay_frame(replay, count))
+        return 0;
+
+    size_t out = 0;
+    for (size_t i = 1; i < replay->state_end; ++i) {
+        const EntityState* state = &replay->states[i];
+        if (state->id == INVALID_ENTITY_ID)
+            continue;
+
+        replay->ids[out] = state->id;
+        replay->x[out] = state->q[0] * replay->quantum;
+        replay->y[out] = state->q[1] * replay->quantum;
+        replay->velocity_x[out] = state->q[2] * replay->quantum;
+        replay->velocity_y[out] = state->q[3] * replay->quantum;
+        replay->radius[out] = state->radius;
+        replay->color[out] = state->color;
+        replay->has_display[out] = (state->flags & ENTRY_FLAG_DISPLAY) != 0;
+        out++;
+    }
+
+    *o_frame = (ReplayFrame) {
+        .ids            = replay->ids,
+        .x              = replay->x,
+        .y              = replay->y,
+        .velocity_x     = replay->velocity_x,
+        .velocity_y     = replay->velocity_y,
+        .radius         = replay->radius,
+        .color          = replay->color,
+        .has_display    = replay->has_display,
+        .count          = count,
+        .step           = step,
+    };
+
+    return 1;
+}
+
+static void* _writer_thread(void* args) {
+    Recorder* recorder = args;
+
+    PROFILE_THREAD_NAME("recorder");
+
+    for (;;) {
+        pthread_mutex_lock(&recorder->wake_lock);
+        while (recorder->running
+            && atomic_load_explicit(&recorder->head, memory_order_relaxed) == atomic_load_explicit(&recorder->tail, memory_order_relaxed))
+            pthread_cond_wait(&recorder->wake, &recorder->wake_lock);
+
+        const int running = recorder->running;
+        pthread_mutex_unlock(&recorder->wake_lock);
+
+        const size_t head = atomic_load_explicit(&recorder->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        while (tail != head) {
+            if (! recorder->failed)
+                _encode_frame(recorder, &recorder->ring[tail % recorder->ring_frames]);
+
+            // hands the slot back to the capturing thread
+            atomic_store_explicit(&recorder->tail, ++tail, memory_order_release);
+        }
+
+        // nothing captures once the recorder is being destroyed, so the ring
+        // is empty for good
+        if (! running)
+            break;
+    }
+
+    if (! recorder->failed && fflush(recorder->file) != 0)
+        fprintf(stderr, "ERROR: failed to write recording (%s)\n", strerror(errno));
+
+    return NULL;
+}
+
+// copies out every component in a chunk of the pool written after since. the
+// whole pool is reserved for, as every chunk may have been
+static int _capture_pool(CapturedPool* pool, const EcsWorld* world, const ComponentType type, const EcsVersion since,
+    const EntityID* owners, const void* a, const void* b, const size_t count) {
+    if (count > pool->capacity) {
+        size_t new_capacity = pool->capacity > 0 ? pool->capacity : 1024;
+        while (new_capacity < count)
+            new_capacity *= 2;
+
+        uint32_t* new_slots = realloc(pool->slots, sizeof(uint32_t)*new_capacity);
+        if (new_slots != NULL)
+            pool->slots = new_slots;
+
+        EntityID* new_owners = new_slots != NULL ? realloc(pool->owners, sizeof(EntityID)*new_capacity) : NULL;
+        if (new_owners != NULL)
+            pool->owners = new_owners;
+
+        void* new_a = new_owners != NULL ? realloc(pool->values[0], CAPTURED_VALUE_SIZE*new_capacity) : NULL;
+        if (new_a != NULL)
+            pool->values[0] = new_a;
+
+        void* new_b = new_a != NULL ? realloc(pool->values[1], CAPTURED_VALUE_SIZE*new_capacity) : NULL;
+        if (new_b == NULL)
+            return 0;
+
+        pool->values[1] = new_b;
+        pool->capacity = new_capacity;
+    }
+
+    const uint8_t* from_a = a;
+    const uint8_t* from_b = b;
+    uint8_t* to_a = pool->values[0];
+    uint8_t* to_b = pool->values[1];
+
+    size_t captured = 0;
+    EcsQuery query = ecs_query_changed(world, COMPONENT_MASK(type), COMPONENT_MASK(type), since);
+    while (ecs_query_next(&query)) {
+        const size_t slot = query.index[type];
+        pool->slots[captured] = (uint32_t)slot;
+        pool->owners[captured] = owners[slot];
+        memcpy(to_a + (captured * CAPTURED_VALUE_SIZE), from_a + (slot * CAPTURED_VALUE_SIZE), CAPTURED_VALUE_SIZE);
+        memcpy(to_b + (captured * CAPTURED_VALUE_SIZE), from_b + (slot * CAPTURED_VALUE_SIZE), CAPTURED_VALUE_SIZE);
+        captured++;
+    }
+
+    pool->count = captured;
+    pool->pool_count = count;
+    return 1;
+}
+
+static void _free_captured_frame(CapturedFrame* frame) {
+    for (size_t i = 0; i < CAPTURE_COUNT; ++i) {
+        free(frame->pools[i].slots);
+        free(frame->pools[i].owners);
+        free(frame->pools[i].values[0]);
+        free(frame->pools[i].values[1]);
+    }
+}
+
+// brings a mirrored pool up to date with what was captured of it. every
+// index whose component came or went, or may have changed, is marked dirty
+static int _apply_captured_pool(Recorder* recorder, const size_t type, const CapturedPool* captured) {
+    MirroredPool* mirror = &recorder->pools[type];
+
+    // every written slot and every slot dropped off the end loses its old
+    // owner before any gets a new one, so an entity that was moved from one
+    // to another ends up at the right one
+    for (size_t i = 0; i < captured->count; ++i) {
+        if (captured->slots[i] < mirror->count)
+            _release_slot(recorder, type, captured->slots[i]);
+    }
+
+    for (size_t slot = captured->pool_count; slot < mirror->count; ++slot)
+        _release_slot(recorder, type, slot);
+
+    if (captured->pool_count > mirror->capacity) {
+        size_t new_capacity = mirror->capacity > 0 ? mirror->capacity : 1024;
+        while (new_capacity < captured->pool_count)
+            new_capacity *= 2;
+
+        EntityID* owners = realloc(mirror->owners, sizeof(EntityID)*new_capacity);
+        if (owners != NULL)
+            mirror->owners = owners;
+
+        void* a = owners != NULL ? realloc(mirror->values[0], CAPTURED_VALUE_SIZE*new_capacity) : NULL;
+        if (a != NULL)
+            mirror->values[0] = a;
+
+        void* b = a != NULL ? realloc(mirror->values[1], CAPTURED_VALUE_SIZE*new_capacity) : NULL;
+        if (b == NULL)
+            return 0;
+
+        mirror->values[1] = b;
+        mirror->capacity = new_capacity;
+    }
+
+    const uint8_t* from_a = captured->values[0];
+    const uint8_t* from_b = captured->values[1];
+    uint8_t* to_a = mirror->values[0];
+    uint8_t* to_b = mirror->values[1];
+
+    for (size_t i = 0; i < captured->count; ++i) {
+        const size_t slot = captured->slots[i];
+        const size_t index = ECS_ENTITY_INDEX(captured->owners[i]);
+
+        mirror->owners[slot] = captured->owners[i];
+        memcpy(to_a + (slot * CAPTURED_VALUE_SIZE), from_a + (i * CAPTURED_VALUE_SIZE), CAPTURED_VALUE_SIZE);
+        memcpy(to_b + (slot * CAPTURED_VALUE_SIZE), from_b + (i * CAPTURED_VALUE_SIZE), CAPTURED_VALUE_SIZE);
+
+        recorder->slots[type][index] = slot + 1;
+        recorder->dirty[index / 64] |= (uint64_t)1 << (index % 64);
+    }
+
+    mirror->count = captured->pool_count;
+    return 1;
+}
+
+// a slot's old owner may already have been given a new one this frame
+static void _release_slot(Recorder* recorder, const size_t type, const size_t slot) {
+    const size_t index = ECS_ENTITY_INDEX(recorder->pools[type].owners[slot]);
+    if (recorder->slots[type][index] == slot + 1)
+        recorder->slots[type][index] = 0;
+
+    recorder->dirty[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+// only walks the entity indices marked dirty, in order, so entries come out
+// sorted and their index gaps stay small. an entity that kept its quantized
+// state costs nothing, and one in chunks nobody wrote to isn't even looked at
+static int _encode_frame(Recorder* recorder, const CapturedFrame* frame) {
+    PROFILE_SCOPE("recorder_encode_frame");
+
+    // only captured components can belong to indices not seen before
+    size_t end = recorder->state_end;
+    for (size_t type = 0; type < CAPTURE_COUNT; ++type) {
+        const CapturedPool* pool = &frame->pools[type];
+        for (size_t i = 0; i < pool->count; ++i) {
+            const size_t index = ECS_ENTITY_INDEX(pool->owners[i]);
+            if (index >= end)
+                end = index + 1;
+        }
+    }
+
+    if (end > recorder->state_capacity) {
+        const size_t old_capacity = recorder->state_capacity;
+        if (! _grow_states(&recorder->states, &recorder->state_capacity, end)
+            || ! _grow_recorder_slots(recorder, old_capacity, recorder->state_capacity)) {
+            fprintf(stderr, "ERROR: out of memory encoding recording, stopping\n");
+            recorder->failed = 1;
+            return 0;
+        }
+    }
+
+    for (size_t type = 0; type < CAPTURE_COUNT; ++type) {
+        if (! _apply_captured_pool(recorder, type, &frame->pools[type])) {
+            fprintf(stderr, "ERROR: out of memory encoding recording, stopping\n");
+            recorder->failed = 1;
+            return 0;
+        }
+    }
+
+    const MirroredPool* positions = &recorder->pools[CAPTURE_POSITION];
+    const MirroredPool* bodies = &recorder->pools[CAPTURE_RIGID_BODY];
+    const MirroredPool* displays = &recorder->pools[CAPTURE_DISPLAY];
+    const float inverse_quantum = 1.f / recorder->quantum;
+
+    ByteBuffer* entries = &recorder->entries;
+    entries->size = 0;
+
+    uint64_t entry_count = 0;
+    size_t last_index = 0;
+    int ok = 1;
+
+    const size_t dirty_words = (end + 63) / 64;
+    for (size_t word = 0; word < dirty_words && ok; ++word) {
+        uint64_t dirty = recorder->dirty[word];
+        recorder->dirty[word] = 0;
+
+        while (dirty != 0 && ok) {
+            const size_t index = (word * 64) + (size_t)__builtin_ctzll(dirty);
+            dirty &= dirty - 1;
+
+            EntityState* state = &recorder->states[index];
+            const size_t position_slot = recorder->slots[CAPTURE_POSITION][index];
+            if (position_slot == 0 && state->id == INVALID_ENTITY_ID)
+                continue;
+
+            ok = _reserve_bytes(entries, entries->size + MAX_ENTRY_SIZE);
+            if (! ok)
+                break;
+
+            uint8_t* out = entries->data + entries->size;
+            const uint64_t gap = index - last_index;
+
+            if (position_slot == 0) {
+                out = _put_varint(out, (gap << ENTRY_KIND_BITS) | ENTRY_DESPAWN);
+                state->id = INVALID_ENTITY_ID;
+                entries->size = out - entries->data;
+                last_index = index;
+                entry_count++;
+                continue;
+            }
+
+            const EntityID id = positions->owners[position_slot - 1];
+            const float* x = positions->values[0];
+            const float* y = positions->values[1];
+
+            int32_t q[QUANTIZED_COUNT] = {
+                _quantize(x[position_slot - 1], inverse_quantum),
+                _quantize(y[position_slot - 1], inverse_quantum),
+                0,
+                0,
+            };
+
+            // a component slot only belongs to this entity if the ids match
+            const size_t body_slot = recorder->slots[CAPTURE_RIGID_BODY][index];
+            if (body_slot != 0 && bodies->owners[body_slot - 1] == id) {
+                q[2] = _quantize(((const float*)bodies->values[0])[body_slot - 1], inverse_quantum);
+                q[3] = _quantize(((const float*)bodies->values[1])[body_slot - 1], inverse_quantum);
+            }
+
+            uint8_t flags = 0;
+            float radius = 0.f;
+            Color color = { 0 };
+            const size_t display_slot = recorder->slots[CAPTURE_DISPLAY][index];
+            if (display_slot != 0 && displays->owners[display_slot - 1] == id) {
+                flags |= ENTRY_FLAG_DISPLAY;
+                radius = ((const float*)displays->values[0])[display_slot - 1];
+                color = ((const Color*)displays->values[1])[display_slot - 1];
+            }
+
+            const int same_display = state->flags == flags && state->radius == radius
+                && memcmp(&state->color, &color, sizeof(color)) == 0;
+
+            if (state->id == id && same_display) {
+                if (memcmp(state->q, q, sizeof(q)) == 0)
+                    continue;
+
+                out = _put_varint(out, (gap << ENTRY_KIND_BITS) | ENTRY_UPDATE);
+                for (size_t i = 0; i < QUANTIZED_COUNT; ++i)
+                    out = _put_varint(out, _zigzag((int64_t)q[i] - state->q[i]));
+            } else {
+                out = _put_varint(out, (gap << ENTRY_KIND_BITS) | ENTRY_FULL);
+                out = _put_varint(out, ECS_ENTITY_GENERATION(id));
+                for (size_t i = 0; i < QUANTIZED_COUNT; ++i)
+                    out = _put_varint(out, _zigzag(q[i]));
+
+                *out++ = flags;
+                if (flags & ENTRY_FLAG_DISPLAY) {
+                    memcpy(out, &radius, sizeof(float));
+                    memcpy(out + sizeof(float), &color, sizeof(Color));
+                    out += sizeof(float) + sizeof(Color);
+                }
+
+                state->id = id;
+                state->flags = flags;
+                state->radius = radius;
+                state->color = color;
+            }
+
+            memcpy(state->q, q, sizeof(q));
+            entries->size = out - entries->data;
+            last_index = index;
+            entry_count++;
+        }
+    }
+
+    recorder->state_end = end;
+
+    if (! ok) {
+        fprintf(stderr, "ERROR: out of memory encoding recording, stopping\n");
+        recorder->failed = 1;
+        return 0;
+    }
+
+    // each frame is its size, then the step, the entry count and the entries
+    uint8_t prefix[MAX_VARINT_SIZE * 3];
+    uint8_t* frame_header = prefix + MAX_VARINT_SIZE;
+    uint8_t* frame_header_end = _put_varint(_put_varint(frame_header, frame->step), entry_count);
+    const size_t frame_size = (frame_header_end - frame_header) + entries->size;
+
+    // the size goes right in front of the step and count, so all three are
+    // written in one go
+    uint8_t size_bytes[MAX_VARINT_SIZE];
+    const size_t size_length = _put_varint(size_bytes, frame_size) - size_bytes;
+    frame_header -= size_length;
+    memcpy(frame_header, size_bytes, size_length);
+
+    const size_t prefix_size = frame_header_end - frame_header;
+    if (fwrite(frame_header, 1, prefix_size, recorder->file) != prefix_size
+        || fwrite(entries->data, 1, entries->size, recorder->file) != entries->size) {
+        fprintf(stderr, "ERROR: failed to write recording (%s), stopping\n", strerror(errno));
+        recorder->failed = 1;
+        return 0;
+    }
+
+    atomic_fetch_add_explicit(&recorder->frames_written, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&recorder->bytes_written, prefix_size + entries->size, memory_order_relaxed);
+    return 1;
+}
+
+static int _grow_states(EntityState** states, size_t* capacity, const size_t min_capacity) {
+    if (min_capacity <= *capacity)
+        return 1;
+
+    size_t new_capacity = *capacity > 0 ? *capacity : 1024;
+    while (new_capacity < min_capacity)
+        new_capacity *= 2;
+
+    EntityState* new_states = realloc(*states, sizeof(EntityState)*new_capacity);
+    if (new_states == NULL)
+        return 0;
+
+    memset(new_states + *capacity, 0, sizeof(EntityState)*(new_capacity - *capacity));
+    *states = new_states;
+    *capacity = new_capacity;
+    return 1;
+}
+
+// state capacities are always a multiple of 64, so the dirty bits fill
+// whole words
+static int _grow_recorder_slots(Recorder* recorder, const size_t old_capacity, const size_t new_capacity) {
+    uint64_t* dirty = realloc(recorder->dirty, sizeof(uint64_t)*(new_capacity / 64));
+    if (dirty == NULL)
+        return 0;
+
+    memset(dirty + (old_capacity / 64), 0, sizeof(uint64_t)*((new_capacity - old_capacity) / 64));
+    recorder->dirty = dirty;
+
+    for (size_t type = 0; type < CAPTURE_COUNT; ++type) {
+        size_t* slots = realloc(recorder->slots[type], sizeof(size_t)*new_capacity);
+        if (slots == NULL)
+            return 0;
+
+        memset(slots + old_capacity, 0, sizeof(size_t)*(new_capacity - old_capacity));
+        recorder->slots[type] = slots;
+    }
+
+    return 1;
+}
+
+static int _reserve_bytes(ByteBuffer* buffer, const size_t size) {
+    if (size <= buffer->capacity)
+        return 1;
+
+    size_t new_capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+    while (new_capacity < size)
+        new_capacity *= 2;
+
+    uint8_t* data = realloc(buffer->data, new_capacity);
+    if (data == NULL)
+        return 0;
+
+    buffer->data = data;
+    buffer->capacity = new_capacity;
+    return 1;
+}
+
+static int _grow_replay_frame(Replay* replay, const size_t min_capacity) {
+    if (min_capacity <= replay->frame_capacity)
+        return 1;
+
+    size_t new_capacity = replay->frame_capacity > 0 ? replay->frame_capacity : 1024;
+    while (new_capacity < min_capacity)
+        new_capacity *= 2;
+
+    // realloc leaves the old block alone on failure, so keep whichever
+    // pointers did move and leave the capacity where it was
+    EntityID* ids = realloc(replay->ids, sizeof(EntityID)*new_capacity);
+    if (ids != NULL)        replay->ids = ids;
+    float* x = ids != NULL ? realloc(replay->x, sizeof(float)*new_capacity) : NULL;
+    if (x != NULL)          replay->x = x;
+    float* y = x != NULL ? realloc(replay->y, sizeof(float)*new_capacity) : NULL;
+    if (y != NULL)          replay->y = y;
+    float* velocity_x = y != NULL ? realloc(replay->velocity_x, sizeof(float)*new_capacity) : NULL;
+    if (velocity_x != NULL) replay->velocity_x = velocity_x;
+    float* velocity_y = velocity_x != NULL ? realloc(replay->velocity_y, sizeof(float)*new_capacity) : NULL;
+    if (velocity_y != NULL) replay->velocity_y = velocity_y;
+    float* radius = velocity_y != NULL ? realloc(replay->radius, sizeof(float)*new_capacity) : NULL;
+    if (radius != NULL)     replay->radius = radius;
+    Color* color = radius != NULL ? realloc(replay->color, sizeof(Color)*new_capacity) : NULL;
+    if (color != NULL)      replay->color = color;
+    uint8_t* has_display = color != NULL ? realloc(replay->has_display, sizeof(uint8_t)*new_capacity) : NULL;
+    if (has_display == NULL) {
+        fprintf(stderr, "ERROR: out of memory decoding recording\n");
+        return 0;
+    }
+
+    replay->has_display = has_display;
+    replay->frame_capacity = new_capacity;
+    return 1;
+}
+
+static int32_t _quantize(const float value, const float inverse_quantum) {
+    const float scaled = value * inverse_quantum;
+
+    // saturate rather than wrap, and send nan to 0
+    if (! (scaled > (float)INT32_MIN))
+        return scaled != scaled ? 0 : INT32_MIN;
+
+    if (scaled >= (float)INT32_MAX)
+        return INT32_MAX;
+
+    return (int32_t)lrintf(scaled);
+}
+
+static uint8_t* _put_varint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static int _get_varint(const uint8_t** cursor, const uint8_t* end, uint64_t* o_value) {
+    uint64_t value = 0;
+    for (unsigned int shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        const uint8_t byte = *(*cursor)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *o_value = value;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int _read_varint(FILE* file, uint64_t* o_value, int* o_eof) {
+    uint64_t value = 0;
+    *o_eof = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(file);
+        if (byte == EOF) {
+            // running out cleanly between frames is the end of the recording
+            *o_eof = shift == 0;
+            return 0;
+        }
+
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *o_value = value;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// maps small negative and positive numbers alike to small varints
+static uint64_t _zigzag(const int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t _unzigzag(const uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
@@ -0,0 +1,74 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "raylib.h"
+#include "ecs.h"
+
+// a recording is a stream of frames, one per physics step, holding the
+// position, velocity and display of every entity with a position. positions
+// and velocities are quantized to multiples of quantum, and each frame only
+// stores the entities that spawned, despawned or changed since the frame
+// before it, as varint packed deltas of their quantized values.
+typedef struct Recorder Recorder;
+typedef struct Replay Replay;
+
+#define DEFAULT_RECORDER_RING_FRAMES 16
+#define DEFAULT_RECORDER_QUANTUM (1.f / 64.f)
+
+typedef struct {
+    size_t  ring_frames;    // captured steps waiting on the writer thread
+    float   quantum;
+} RecorderConfig;
+
+typedef struct {
+    uint64_t    frames_written;
+    uint64_t    frames_dropped;     // captured while the ring was full
+    uint64_t    bytes_written;
+    uint64_t    components_captured;    // copied out of the world, over every captured step
+} RecorderStats;
+
+// a NULL config uses the defaults. starts the writer thread, returns NULL on
+// failure
+Recorder* recorder_create(const char* path, const RecorderConfig* config);
+
+// writes out every step already captured, then stops the writer thread.
+// nothing may be capturing at the time
+void recorder_destroy(Recorder* recorder);
+
+// one thread at a time, with the world locked, and always the same world.
+// copies the components in chunks written since the last captured step into
+// the ring, found with ecs_query_changed, and leaves encoding and writing to
+// the writer thread, so it never waits on the disk. a step captured while the
+// ring is full is dropped, and its changes go out with the next frame
+// instead. returns 0 if it was dropped
+int recorder_capture(Recorder* recorder, EcsWorld* world, const uint64_t step);
+
+void recorder_get_stats(Recorder* recorder, RecorderStats* o_stats);
+
+// one decoded frame, entities in index order. entities without a rigid body
+// have no velocity, and radius and color are only set where has_display is
+typedef struct {
+    const EntityID* ids;
+    const float*    x;
+    const float*    y;
+    const float*    velocity_x;
+    const float*    velocity_y;
+    const float*    radius;
+    const Color*    color;
+    const uint8_t*  has_display;
+    size_t          count;
+    uint64_t        step;
+} ReplayFrame;
+
+// returns NULL if the file isn't a recording this build can read
+Replay* replay_open(const char* path);
+void replay_close(Replay* replay);
+
+// decodes the next frame into o_frame, which stays valid until the next call.
+// returns 0 at the end of the recording or on a corrupt frame
+int replay_next(Replay* replay, ReplayFrame* o_frame);
+
+#endif // #ifndef RECORDING_H
@@ -0,0 +1,193 @@
+#include "render_backend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "raylib.h"
+#include "rlgl.h"
+#include "profiler.h"
+
+#define NS_PER_SECOND 1000000000ull
+
+// vertices handed to rlgl between batch checks. well under the default batch
+// size, so a full batch is flushed between groups rather than mid circle
+#define RAYLIB_GROUP_VERTICES 4096
+
+struct RenderBackend {
+    RenderBackendDesc   desc;
+    void                (*destroy_context)(void* context);
+    RenderStats         stats;
+};
+
+// one segment's worth of unit circle per entry, plus the closing point
+typedef struct {
+    int     segments;
+    float*  sin_table;
+    float*  cos_table;
+} RaylibCircles;
+
+static RenderBackend* _create_backend(const RenderBackendDesc* desc, void (*destroy_context)(void* context));
+static void _submit_raylib(void* context, const DrawCircleCommand* circles, const size_t count);
+static void _destroy_raylib(void* context);
+static void _submit_null(void* context, const DrawCircleCommand* circles, const size_t count);
+static uint64_t _now_ns(void);
+
+RenderBackend* render_backend_create(const RenderBackendDesc* desc) {
+    if (desc->submit == NULL) {
+        fprintf(stderr, "ERROR: render backend %s has nothing to submit with\n", desc->name != NULL ? desc->name : "(unnamed)");
+        return NULL;
+    }
+
+    return _create_backend(desc, NULL);
+}
+
+RenderBackend* render_backend_create_raylib(const int segments) {
+    if (segments < 3) {
+        fprintf(stderr, "ERROR: circles need at least 3 segments, got %d\n", segments);
+        return NULL;
+    }
+
+    RaylibCircles* raylib = malloc(sizeof(RaylibCircles));
+    float* sin_table = malloc(sizeof(float)*(segments + 1));
+    float* cos_table = malloc(sizeof(float)*(segments + 1));
+    if (raylib == NULL || sin_table == NULL || cos_table == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate raylib render backend\n");
+        free(raylib);
+        free(sin_table);
+        free(cos_table);
+        return NULL;
+    }
+
+    // with x from sin and y from cos, walking the table forwards goes counter
+    // clockwise on a y down screen, which is the winding rlgl's back face
+    // culling keeps
+    const float step = (2.f * PI) / segments;
+    for (int i = 0; i <= segments; ++i) {
+        sin_table[i] = sinf(step * i);
+        cos_table[i] = cosf(step * i);
+    }
+
+    *raylib = (RaylibCircles) {
+        .segments   = segments,
+        .sin_table  = sin_table,
+        .cos_table  = cos_table,
+    };
+
+    const RenderBackendDesc desc = {
+        .name       = "raylib",
+        .submit     = _submit_raylib,
+        .context    = raylib,
+    };
+
+    RenderBackend* backend = _create_backend(&desc, _destroy_raylib);
+    if (backend == NULL)
+        _destroy_raylib(raylib);
+
+    return backend;
+}
+
+RenderBackend* render_backend_create_null(void) {
+    const RenderBackendDesc desc = {
+        .name       = "null",
+        .submit     = _submit_null,
+        .context    = NULL,
+    };
+
+    return _create_backend(&desc, NULL);
+}
+
+void render_backend_destroy(RenderBackend* backend) {
+    if (backend == NULL)
+        return;
+
+    if (backend->destroy_context != NULL)
+        backend->destroy_context(backend->desc.context);
+
+    free(backend);
+}
+
+const char* render_backend_name(const RenderBackend* backend) {
+    return backend->desc.name != NULL ? backend->desc.name : "(unnamed)";
+}
+
+void render_backend_submit(RenderBackend* backend, const RenderSnapshot* snapshot) {
+    PROFILE_SCOPE("render_backend_submit");
+
+    const uint64_t start_ns = _now_ns();
+    backend->desc.submit(backend->desc.context, snapshot->circles, snapshot->count);
+    const uint64_t submit_ns = _now_ns() - start_ns;
+
+    RenderStats* stats = &backend->stats;
+    stats->frames++;
+    stats->circles += snapshot->count;
+    stats->last_submit_ns = submit_ns;
+    if (submit_ns > stats->max_submit_ns)
+        stats->max_submit_ns = submit_ns;
+    stats->mean_submit_ns += (submit_ns - stats->mean_submit_ns) / stats->frames;
+}
+
+void render_backend_get_stats(const RenderBackend* backend, RenderStats* o_stats) {
+    *o_stats = backend->stats;
+}
+
+static RenderBackend* _create_backend(const RenderBackendDesc* desc, void (*destroy_context)(void* context)) {
+    RenderBackend* backend = calloc(1, sizeof(RenderBackend));
+    if (backend == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate render backend\n");
+        return NULL;
+    }
+
+    backend->desc = *desc;
+    backend->destroy_context = destroy_context;
+    return backend;
+}
+
+// draws each circle as a fan of triangles. DrawCircle checks the batch limit
+// and works out every vertex's angle again for each circle, here the limit is
+// checked once per group and the angles come from the tables
+static void _submit_raylib(void* context, const DrawCircleCommand* circles, const size_t count) {
+    const RaylibCircles* raylib = context;
+    const size_t vertices_per_circle = 3 * (size_t)raylib->segments;
+    const size_t group_size = vertices_per_circle < RAYLIB_GROUP_VERTICES ? RAYLIB_GROUP_VERTICES / vertices_per_circle : 1;
+
+    for (size_t begin = 0; begin < count; begin += group_size) {
+        const size_t end = begin + group_size < count ? begin + group_size : count;
+
+        rlCheckRenderBatchLimit((int)((end - begin) * vertices_per_circle));
+        rlBegin(RL_TRIANGLES);
+
+        for (size_t i = begin; i < end; ++i) {
+            const DrawCircleCommand* circle = &circles[i];
+            rlColor4ub(circle->color.r, circle->color.g, circle->color.b, circle->color.a);
+
+            for (int s = 0; s < raylib->segments; ++s) {
+                rlVertex2f(circle->x, circle->y);
+                rlVertex2f(circle->x + (raylib->sin_table[s] * circle->radius), circle->y + (raylib->cos_table[s] * circle->radius));
+                rlVertex2f(circle->x + (raylib->sin_table[s + 1] * circle->radius), circle->y + (raylib->cos_table[s + 1] * circle->radius));
+            }
+        }
+
+        rlEnd();
+    }
+}
+
+static void _destroy_raylib(void* context) {
+    RaylibCircles* raylib = context;
+    free(raylib->sin_table);
+    free(raylib->cos_table);
+    free(raylib);
+}
+
+static void _submit_null(void* context, const DrawCircleCommand* circles, const size_t count) {
+    (void)context;
+    (void)circles;
+    (void)count;
+}
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NS_PER_SECOND) + (uint64_t)ts.tv_nsec;
+}
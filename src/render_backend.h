@@ -0,0 +1,51 @@
+#ifndef RENDER_BACKEND_H
+#define RENDER_BACKEND_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "render_snapshot.h"
+
+// backends consume finished draw lists and never see the world, so drawing
+// never holds the ecs lock, and submission can be measured and tuned apart
+// from everything else.
+typedef void (*RenderSubmitFunction)(void* context, const DrawCircleCommand* circles, const size_t count);
+
+typedef struct {
+    const char*             name;
+    RenderSubmitFunction    submit;
+    void*                   context;
+} RenderBackendDesc;
+
+typedef struct RenderBackend RenderBackend;
+
+typedef struct {
+    uint64_t    frames;
+    uint64_t    circles;
+    uint64_t    last_submit_ns;
+    uint64_t    max_submit_ns;
+    double      mean_submit_ns;
+} RenderStats;
+
+// matches raylib's own DrawCircle
+#define DEFAULT_RAYLIB_CIRCLE_SEGMENTS 36
+
+// the context belongs to the caller and has to outlive the backend
+RenderBackend* render_backend_create(const RenderBackendDesc* desc);
+
+// every circle goes through shared rlgl triangle batches, rather than a draw
+// call per circle. fewer segments are cheaper and less round. needs a window
+RenderBackend* render_backend_create_raylib(const int segments);
+
+// draws nothing and only keeps stats, for headless runs
+RenderBackend* render_backend_create_null(void);
+
+void render_backend_destroy(RenderBackend* backend);
+
+const char* render_backend_name(const RenderBackend* backend);
+
+// one thread at a time
+void render_backend_submit(RenderBackend* backend, const RenderSnapshot* snapshot);
+void render_backend_get_stats(const RenderBackend* backend, RenderStats* o_stats);
+
+#endif // #ifndef RENDER_BACKEND_H
@@ -0,0 +1,70 @@
+#include "render_snapshot.h"
+
+#include <string.h>
+#include <stdatomic.h>
+
+#define SNAPSHOT_BUFFER_COUNT 3
+
+// the shared slot holds a buffer index plus a flag set when the writer has
+// put a frame there the reader hasn't picked up yet
+#define SNAPSHOT_INDEX_MASK 0x3u
+#define SNAPSHOT_FRESH      0x4u
+
+static RenderSnapshot   s_buffers[SNAPSHOT_BUFFER_COUNT];
+static atomic_uint      s_shared    = 1;
+static unsigned int     s_back      = 0;  // owned by the writer
+static unsigned int     s_front     = 2;  // owned by the reader
+
+static void _free_snapshot(RenderSnapshot* snapshot);
+
+void render_snapshot_init(void) {
+    memset(s_buffers, 0, sizeof(s_buffers));
+    atomic_store(&s_shared, 1);
+    s_back = 0;
+    s_front = 2;
+}
+
+void render_snapshot_free(void) {
+    for (size_t i = 0; i < SNAPSHOT_BUFFER_COUNT; ++i)
+        _free_snapshot(&s_buffers[i]);
+}
+
+RenderSnapshot* render_snapshot_begin_write(void) {
+    return &s_buffers[s_back];
+}
+
+int render_snapshot_reserve(RenderSnapshot* snapshot, const size_t count) {
+    if (count <= snapshot->capacity)
+        return 1;
+
+    size_t new_capacity = snapshot->capacity > 0 ? snapshot->capacity : 256;
+    while (new_capacity < count)
+        new_capacity *= 2;
+
+    DrawCircleCommand* circles = realloc(snapshot->circles, sizeof(DrawCircleCommand)*new_capacity);
+    if (circles == NULL)
+        return 0;
+
+    snapshot->circles = circles;
+    snapshot->capacity = new_capacity;
+    return 1;
+}
+
+void render_snapshot_publish(void) {
+    const unsigned int previous = atomic_exchange_explicit(&s_shared, s_back | SNAPSHOT_FRESH, memory_order_acq_rel);
+    s_back = previous & SNAPSHOT_INDEX_MASK;
+}
+
+const RenderSnapshot* render_snapshot_acquire(void) {
+    if (atomic_load_explicit(&s_shared, memory_order_relaxed) & SNAPSHOT_FRESH) {
+        const unsigned int previous = atomic_exchange_explicit(&s_shared, s_front, memory_order_acq_rel);
+        s_front = previous & SNAPSHOT_INDEX_MASK;
+    }
+
+    return &s_buffers[s_front];
+}
+
+static void _free_snapshot(RenderSnapshot* snapshot) {
+    free(snapshot->circles);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
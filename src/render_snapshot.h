@@ -0,0 +1,42 @@
+#ifndef RENDER_SNAPSHOT_H
+#define RENDER_SNAPSHOT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "raylib.h"
+
+// one circle of a packed draw list. everything a draw call needs sits side
+// by side, so a backend submits a frame in one linear walk
+typedef struct {
+    float   x;
+    float   y;
+    float   radius;
+    Color   color;
+} DrawCircleCommand;
+
+// everything the renderer needs from one completed physics step
+typedef struct {
+    DrawCircleCommand*  circles;
+    size_t              count;
+    size_t              capacity;
+    uint64_t            step;
+} RenderSnapshot;
+
+// a triple buffer shared by one writer (physics) and one reader (render).
+// handing buffers over is a single atomic exchange on either side, so
+// neither thread ever waits on the other, and the reader always holds a
+// complete frame.
+void render_snapshot_init(void);
+void render_snapshot_free(void);
+
+// writer side. the returned buffer belongs to the writer until it's published
+RenderSnapshot* render_snapshot_begin_write(void);
+int render_snapshot_reserve(RenderSnapshot* snapshot, const size_t count);
+void render_snapshot_publish(void);
+
+// reader side. returns the newest published frame, which stays valid until
+// the next acquire
+const RenderSnapshot* render_snapshot_acquire(void);
+
+#endif // #ifndef RENDER_SNAPSHOT_H
@@ -0,0 +1,174 @@
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "profiler.h"
+
+#define INITIAL_SYSTEM_CAPACITY 8
+
+struct Scheduler {
+    ThreadPool*     pool;
+    SystemDesc*     systems;
+    size_t          system_count;
+    size_t          system_capacity;
+
+    // systems sorted into waves. every system in a wave only depends on
+    // systems in earlier waves, so a wave can run all at once. rebuilt
+    // whenever a system is added
+    size_t*         wave_systems;
+    size_t*         wave_starts;    // wave_count + 1 offsets into wave_systems
+    size_t          wave_count;
+    int             waves_dirty;
+};
+
+typedef struct {
+    const Scheduler*    scheduler;
+    const size_t*       systems;
+    EcsWorld*           world;
+    float               delta_time;
+} WaveJob;
+
+static int _build_waves(Scheduler* scheduler);
+static int _conflicts(const SystemDesc* a, const SystemDesc* b);
+static void _run_system(const SystemDesc* system, EcsWorld* world, const float delta_time);
+static void _wave_job(void* context, size_t begin, size_t end);
+
+Scheduler* scheduler_create(ThreadPool* pool) {
+    Scheduler* scheduler = calloc(1, sizeof(Scheduler));
+    if (scheduler == NULL)
+        return NULL;
+
+    scheduler->pool = pool;
+    return scheduler;
+}
+
+void scheduler_destroy(Scheduler* scheduler) {
+    if (scheduler == NULL)
+        return;
+
+    free(scheduler->systems);
+    free(scheduler->wave_systems);
+    free(scheduler->wave_starts);
+    free(scheduler);
+}
+
+int scheduler_add_system(Scheduler* scheduler, const SystemDesc* desc) {
+    if (desc->run == NULL)
+        return 0;
+
+    if (scheduler->system_count == scheduler->system_capacity) {
+        const size_t new_capacity = scheduler->system_capacity > 0 ? scheduler->system_capacity*2 : INITIAL_SYSTEM_CAPACITY;
+        SystemDesc* systems = realloc(scheduler->systems, sizeof(SystemDesc)*new_capacity);
+        if (systems == NULL) {
+            fprintf(stderr, "ERROR: failed to register system %s\n", desc->name != NULL ? desc->name : "(unnamed)");
+            return 0;
+        }
+
+        scheduler->systems = systems;
+        scheduler->system_capacity = new_capacity;
+    }
+
+    scheduler->systems[scheduler->system_count++] = *desc;
+    scheduler->waves_dirty = 1;
+    return 1;
+}
+
+size_t scheduler_system_count(const Scheduler* scheduler) {
+    return scheduler->system_count;
+}
+
+void scheduler_run(Scheduler* scheduler, EcsWorld* world, const float delta_time) {
+    PROFILE_SCOPE("scheduler_run");
+
+    if (scheduler->waves_dirty && ! _build_waves(scheduler)) {
+        // no graph to go on, fall back to running everything in order
+        for (size_t i = 0; i < scheduler->system_count; ++i)
+            _run_system(&scheduler->systems[i], world, delta_time);
+        return;
+    }
+
+    for (size_t wave = 0; wave < scheduler->wave_count; ++wave) {
+        const size_t start = scheduler->wave_starts[wave];
+        const size_t count = scheduler->wave_starts[wave + 1] - start;
+
+        if (count == 1) {
+            _run_system(&scheduler->systems[scheduler->wave_systems[start]], world, delta_time);
+            continue;
+        }
+
+        WaveJob job = {
+            .scheduler  = scheduler,
+            .systems    = scheduler->wave_systems + start,
+            .world      = world,
+            .delta_time = delta_time,
+        };
+        thread_pool_parallel_for(scheduler->pool, _wave_job, &job, count, 1);
+    }
+}
+
+static int _build_waves(Scheduler* scheduler) {
+    const size_t count = scheduler->system_count;
+
+    size_t* wave_of = malloc(sizeof(size_t)*(count > 0 ? count : 1));
+    size_t* wave_systems = realloc(scheduler->wave_systems, sizeof(size_t)*(count > 0 ? count : 1));
+    if (wave_systems != NULL)
+        scheduler->wave_systems = wave_systems;
+
+    size_t* wave_starts = realloc(scheduler->wave_starts, sizeof(size_t)*(count + 1));
+    if (wave_starts != NULL)
+        scheduler->wave_starts = wave_starts;
+
+    if (wave_of == NULL || wave_systems == NULL || wave_starts == NULL) {
+        fprintf(stderr, "ERROR: out of memory building the system graph\n");
+        free(wave_of);
+        return 0;
+    }
+
+    // a system goes in the wave after the latest earlier system it conflicts
+    // with. registration order is a valid topological order, so one pass is enough
+    size_t wave_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        wave_of[i] = 0;
+        for (size_t j = 0; j < i; ++j) {
+            if (wave_of[j] + 1 > wave_of[i] && _conflicts(&scheduler->systems[i], &scheduler->systems[j]))
+                wave_of[i] = wave_of[j] + 1;
+        }
+
+        if (wave_of[i] + 1 > wave_count)
+            wave_count = wave_of[i] + 1;
+    }
+
+    // counting sort the systems by wave, keeping registration order within one
+    memset(wave_starts, 0, sizeof(size_t)*(count + 1));
+    for (size_t i = 0; i < count; ++i)
+        wave_starts[wave_of[i] + 1]++;
+    for (size_t wave = 0; wave < wave_count; ++wave)
+        wave_starts[wave + 1] += wave_starts[wave];
+
+    for (size_t wave = 0, next = 0; wave < wave_count; ++wave) {
+        for (size_t i = 0; i < count; ++i) {
+            if (wave_of[i] == wave)
+                wave_systems[next++] = i;
+        }
+    }
+
+    free(wave_of);
+    scheduler->wave_count = wave_count;
+    scheduler->waves_dirty = 0;
+    return 1;
+}
+
+static int _conflicts(const SystemDesc* a, const SystemDesc* b) {
+    return (a->writes & (b->reads | b->writes)) || (b->writes & a->reads);
+}
+
+static void _run_system(const SystemDesc* system, EcsWorld* world, const float delta_time) {
+    system->run(world, system->context, delta_time);
+}
+
+static void _wave_job(void* context, size_t begin, size_t end) {
+    const WaveJob* job = context;
+    for (size_t i = begin; i < end; ++i)
+        _run_system(&job->scheduler->systems[job->systems[i]], job->world, job->delta_time);
+}
@@ -0,0 +1,39 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdlib.h>
+
+#include "ecs.h"
+#include "thread_pool.h"
+
+typedef void (*SystemFunction)(EcsWorld* world, void* context, const float delta_time);
+
+// a system declares every pool it touches. two systems conflict when either
+// writes a pool the other reads or writes, and conflicting systems always run
+// in the order they were added. anything else may run at the same time.
+typedef struct {
+    const char*     name;
+    SystemFunction  run;
+    void*           context;
+    ComponentMask   reads;
+    ComponentMask   writes;
+} SystemDesc;
+
+typedef struct Scheduler Scheduler;
+
+// systems that end up running alongside others share the pool's threads, so
+// any parallel_for they make runs inline. a system with nothing to run
+// alongside gets the calling thread, and the whole pool to itself.
+Scheduler* scheduler_create(ThreadPool* pool);
+void scheduler_destroy(Scheduler* scheduler);
+
+// returns 0 on failure
+int scheduler_add_system(Scheduler* scheduler, const SystemDesc* desc);
+size_t scheduler_system_count(const Scheduler* scheduler);
+
+// runs every system once over world. the caller is expected to hold the
+// world's lock, and systems mustn't make structural changes, which belong in
+// a command buffer
+void scheduler_run(Scheduler* scheduler, EcsWorld* world, const float delta_time);
+
+#endif // #ifndef SCHEDULER_H
@@ -1,94 +1,166 @@
 #include "systems.h"
 
 #include "ecs.h"
-#include "vec_maths.h"
+#include "physics_kernel.h"
 #include "raylib.h"
+#include "profiler.h"
+#include "perf_counters.h"
 
-void system_draw(void) {
-    DisplayComponent* displays = NULL;
-    size_t display_count = 0;
-    ecs_get_display_component_array(&displays, &display_count);
-    if (displays == NULL || display_count == 0)
-        return;
+void system_extract_render_snapshot(EcsWorld* world, RenderSnapshot* snapshot) {
+    PROFILE_SCOPE("system_extract_render_snapshot");
 
-    for (size_t i = 0; i < display_count; ++i) {
-        const DisplayComponent* disp = &displays[i];
-        if (disp == NULL)
-            continue;
+    PositionColumns positions;
+    DisplayColumns displays;
+    ecs_get_position_columns(world, &positions);
+    ecs_get_display_columns(world, &displays);
 
-        const EntityID id = disp->owner;
-        const PositionComponent* pos = ecs_get_position_component(id);
-        if (pos == NULL)
-            continue;
+    snapshot->count = 0;
+    if (! render_snapshot_reserve(snapshot, displays.count))
+        return;
 
-        DrawCircle(pos->pos.x, pos->pos.y, disp->radius, disp->color);
+    // one linear walk of the display pool. entities spawned together sit at
+    // the same slot in both pools, so the position is checked for there
+    // before falling back to a lookup
+    for (size_t i = 0; i < displays.count; ++i) {
+        const EntityID entity_id = displays.owners[i];
+
+        Vec2 pos;
+        if (i < positions.count && positions.owners[i] == entity_id) {
+            pos = (Vec2) { .x = positions.x[i], .y = positions.y[i] };
+        } else {
+            PositionComponent position;
+            if (! ecs_get_position_component(world, entity_id, &position))
+                continue;
+
+            pos = position.pos;
+        }
+
+        snapshot->circles[snapshot->count++] = (DrawCircleCommand) {
+            .x      = pos.x,
+            .y      = pos.y,
+            .radius = displays.radius[i],
+            .color  = displays.color[i],
+        };
     }
 }
 
-#define GRAVITY 2000.f
-#define DRAG_COEFFICIENT 0.01f
-
-void system_physics(const float delta_time) {
-    RigidBodyComponent* rigid_bodies = NULL;
-    size_t rigid_body_count = 0;
-    ecs_get_rigid_body_component_array(&rigid_bodies, &rigid_body_count);
+void system_extract_replay_snapshot(const ReplayFrame* frame, RenderSnapshot* snapshot) {
+    PROFILE_SCOPE("system_extract_replay_snapshot");
 
-    if (rigid_bodies == NULL || rigid_body_count == 0)
+    snapshot->count = 0;
+    if (! render_snapshot_reserve(snapshot, frame->count))
         return;
 
-    const float screen_width = GetScreenWidth();
-    const float screen_height = GetScreenHeight();
-
-    for (size_t i = 0; i < rigid_body_count; ++i) {
-        RigidBodyComponent* rb = &rigid_bodies[i];
-        if (rb == NULL)
+    for (size_t i = 0; i < frame->count; ++i) {
+        if (! frame->has_display[i])
             continue;
 
-        const EntityID id = rb->owner;
-        PositionComponent* pos = ecs_get_position_component(id);
-        const CircleColliderComponent* col = ecs_get_circle_collider_component(id);
-
-        if (pos == NULL || col == NULL)
-            continue;
+        snapshot->circles[snapshot->count++] = (DrawCircleCommand) {
+            .x      = frame->x[i],
+            .y      = frame->y[i],
+            .radius = frame->radius[i],
+            .color  = frame->color[i],
+        };
+    }
 
-        // modify velocity based on gravity and drag
-        rb->velocity.y += GRAVITY * rb->mass * delta_time;
+    snapshot->step = frame->step;
+}
 
-        Vec2 drag = vec2_invert(rb->velocity);
-        drag = vec2_mul(drag, DRAG_COEFFICIENT);
+void system_draw(RenderBackend* backend, const RenderSnapshot* snapshot) {
+    PROFILE_SCOPE("system_draw");
+    PERF_SCOPE("system_draw", snapshot->count);
+    render_backend_submit(backend, snapshot);
+}
 
-        rb->velocity = vec2_add(rb->velocity, drag);
+#define GRAVITY 2000.f
+#define DRAG_COEFFICIENT 0.01f
 
-        Vec2 new_pos = {
-            .x = pos->pos.x + (rb->velocity.x * delta_time),
-            .y = pos->pos.y + (rb->velocity.y * delta_time),
-        };
+// big enough to amortise claiming a chunk, and a multiple of the widest
+// kernel batch and of a cache line's worth of floats so no two threads ever
+// write to the same line
+#define PHYSICS_CHUNK_SIZE 4096
+
+// chunks are marked changed from the job that wrote them, so no two jobs may
+// share a change chunk either
+_Static_assert(PHYSICS_CHUNK_SIZE % ECS_CHANGE_CHUNK_SIZE == 0, "physics chunks have to cover whole change chunks");
+
+typedef struct {
+    EcsWorld*                   world;
+    const PhysicsBodies*        bodies;
+    const PhysicsStepParams*    params;
+} PhysicsJob;
+
+static void _physics_job(void* context, size_t begin, size_t end);
+static size_t _get_physics_bodies(EcsWorld* world, PhysicsBodies* o_bodies);
+
+void system_physics(EcsWorld* world, ThreadPool* pool, const float delta_time, const Vec2 bounds) {
+    PROFILE_SCOPE("system_physics");
+
+    PhysicsBodies bodies;
+    const size_t body_count = _get_physics_bodies(world, &bodies);
+
+    const PhysicsStepParams params = {
+        .delta_time         = delta_time,
+        .gravity            = GRAVITY,
+        .drag_coefficient   = DRAG_COEFFICIENT,
+        .bounds             = bounds,
+    };
+
+    PhysicsJob job = {
+        .world  = world,
+        .bodies = &bodies,
+        .params = &params,
+    };
+    thread_pool_parallel_for(pool, _physics_job, &job, body_count, PHYSICS_CHUNK_SIZE);
+}
 
-        const Vec2 max_bound = {
-            .x = screen_width - col->radius,
-            .y = screen_height - col->radius,
-        };
-        const Vec2 min_bound = {
-            .x = col->radius,
-            .y = col->radius,
-        };
+void system_collision(EcsWorld* world, ThreadPool* pool, CollisionGrid* grid, CollisionStats* o_stats) {
+    PROFILE_SCOPE("system_collision");
 
-        if (new_pos.x > max_bound.x) {
-            rb->velocity.x *= -1;
-            new_pos.x = max_bound.x;
-        } else if (new_pos.x < min_bound.x) {
-            rb->velocity.x *= -1;
-            new_pos.x = min_bound.x;
-        }
+    PhysicsBodies bodies;
+    _get_physics_bodies(world, &bodies);
 
-        if (new_pos.y > max_bound.y) {
-            rb->velocity.y *= -1;
-            new_pos.y = max_bound.y;
-        } else if (new_pos.y < min_bound.y) {
-            rb->velocity.y *= -1;
-            new_pos.y = min_bound.y;
-        }
+    collision_resolve(grid, pool, &bodies, o_stats);
 
-        pos->pos = new_pos;
+    // contacts can push any body around, but a step without any leaves
+    // everything as it was
+    if (o_stats->contacts > 0) {
+        ecs_mark_changed(world, COMPONENT_TYPE_POSITION, 0, bodies.count);
+        ecs_mark_changed(world, COMPONENT_TYPE_RIGID_BODY, 0, bodies.count);
     }
 }
+
+static size_t _get_physics_bodies(EcsWorld* world, PhysicsBodies* o_bodies) {
+    // grouping lines up the three pools, so body i is at slot i of every column
+    const size_t body_count = ecs_group(world, COMPONENT_POSITION | COMPONENT_RIGID_BODY | COMPONENT_CIRCLE_COLLIDER);
+
+    PositionColumns positions;
+    RigidBodyColumns rigid_bodies;
+    CircleColliderColumns colliders;
+    ecs_get_position_columns(world, &positions);
+    ecs_get_rigid_body_columns(world, &rigid_bodies);
+    ecs_get_circle_collider_columns(world, &colliders);
+
+    *o_bodies = (PhysicsBodies) {
+        .x          = positions.x,
+        .y          = positions.y,
+        .velocity_x = rigid_bodies.velocity_x,
+        .velocity_y = rigid_bodies.velocity_y,
+        .mass       = rigid_bodies.mass,
+        .radius     = colliders.radius,
+        .count      = body_count,
+    };
+
+    return body_count;
+}
+
+static void _physics_job(void* context, size_t begin, size_t end) {
+    // measured per chunk, on whichever thread ran it
+    PERF_SCOPE("system_physics", end - begin);
+
+    const PhysicsJob* job = context;
+    physics_integrate(job->bodies, job->params, begin, end);
+
+    ecs_mark_changed(job->world, COMPONENT_TYPE_POSITION, begin, end);
+    ecs_mark_changed(job->world, COMPONENT_TYPE_RIGID_BODY, begin, end);
+}
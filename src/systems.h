@@ -1,8 +1,26 @@
 #ifndef SYSTEMS_H
 #define SYSTEMS_H
 
-void system_draw(void);
-void system_physics(const float delta_time);
+#include "ecs.h"
+#include "thread_pool.h"
+#include "render_snapshot.h"
+#include "render_backend.h"
+#include "collision.h"
+#include "recording.h"
+
+// packs everything drawable into a snapshot's draw list for the render
+// thread, in a single pass over the world
+void system_extract_render_snapshot(EcsWorld* world, RenderSnapshot* snapshot);
+
+// the same, from a recorded frame instead of a live world
+void system_extract_replay_snapshot(const ReplayFrame* frame, RenderSnapshot* snapshot);
+
+void system_draw(RenderBackend* backend, const RenderSnapshot* snapshot);
+
+// integration is split across the pool's workers, or run inline if pool is NULL.
+// bodies are kept inside [0, bounds]
+void system_physics(EcsWorld* world, ThreadPool* pool, const float delta_time, const Vec2 bounds);
+void system_collision(EcsWorld* world, ThreadPool* pool, CollisionGrid* grid, CollisionStats* o_stats);
 
 #endif // #ifndef SYSTEMS_H
 
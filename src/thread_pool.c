@@ -0,0 +1,167 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "profiler.h"
+
+struct ThreadPool {
+    pthread_t*      threads;
+    size_t          worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  job_ready;
+    pthread_cond_t  job_done;
+    size_t          generation;
+    size_t          pending_workers;
+    int             shutting_down;
+
+    // the job currently being run, only written while no workers are busy
+    ThreadPoolJob   job;
+    void*           context;
+    size_t          item_count;
+    size_t          chunk_size;
+    atomic_size_t   next_item;
+};
+
+static _Thread_local int t_inside_job = 0;
+
+static void* _worker(void* args);
+static void _claim_chunks(ThreadPool* pool);
+
+ThreadPool* thread_pool_create(const size_t worker_count) {
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    pool->threads = calloc(worker_count > 0 ? worker_count : 1, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < worker_count; ++i) {
+        const int err = pthread_create(&pool->threads[i], NULL, _worker, pool);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: failed to start pool worker %zu (%s)\n", i, strerror(err));
+            break;
+        }
+
+        pool->worker_count++;
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t thread_pool_worker_count(const ThreadPool* pool) {
+    return pool != NULL ? pool->worker_count : 0;
+}
+
+size_t thread_pool_default_worker_count(void) {
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? (size_t)(cores - 1) : 0;
+}
+
+void thread_pool_parallel_for(ThreadPool* pool, ThreadPoolJob job, void* context, const size_t item_count, const size_t chunk_size) {
+    if (item_count == 0)
+        return;
+
+    // not worth waking anyone for a single chunk, and a job that fans out
+    // again would deadlock waiting on workers that are busy running it
+    if (pool == NULL || pool->worker_count == 0 || item_count <= chunk_size || t_inside_job) {
+        job(context, 0, item_count);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->context = context;
+    pool->item_count = item_count;
+    pool->chunk_size = chunk_size > 0 ? chunk_size : 1;
+    atomic_store_explicit(&pool->next_item, 0, memory_order_relaxed);
+    pool->pending_workers = pool->worker_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    _claim_chunks(pool);
+
+    // barrier: the job isn't finished until every worker has run out of chunks
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending_workers > 0)
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* _worker(void* args) {
+    ThreadPool* pool = args;
+    size_t seen_generation = 0;
+
+    PROFILE_THREAD_NAME("pool worker");
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == seen_generation && ! pool->shutting_down)
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+
+        if (pool->shutting_down)
+            break;
+
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        _claim_chunks(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending_workers == 0)
+            pthread_cond_signal(&pool->job_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void _claim_chunks(ThreadPool* pool) {
+    t_inside_job = 1;
+
+    const size_t item_count = pool->item_count;
+    const size_t chunk_size = pool->chunk_size;
+    while (1) {
+        const size_t begin = atomic_fetch_add_explicit(&pool->next_item, chunk_size, memory_order_relaxed);
+        if (begin >= item_count)
+            break;
+
+        const size_t end = begin + chunk_size < item_count ? begin + chunk_size : item_count;
+
+        PROFILE_SCOPE("pool_chunk");
+        pool->job(pool->context, begin, end);
+    }
+
+    t_inside_job = 0;
+}
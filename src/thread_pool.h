@@ -0,0 +1,26 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdlib.h>
+
+typedef struct ThreadPool ThreadPool;
+
+// processes items [begin, end) of a parallel for
+typedef void (*ThreadPoolJob)(void* context, size_t begin, size_t end);
+
+// worker_count threads are started on top of the calling thread, which also
+// takes part in every job. a pool with 0 workers runs everything inline.
+ThreadPool* thread_pool_create(const size_t worker_count);
+void thread_pool_destroy(ThreadPool* pool);
+
+size_t thread_pool_worker_count(const ThreadPool* pool);
+
+// one worker per online core, minus the core the calling thread runs on
+size_t thread_pool_default_worker_count(void);
+
+// splits [0, item_count) into chunks of chunk_size which the caller and the
+// workers claim until none are left, and returns once every chunk is done.
+// calls made from inside a job, or with a NULL pool, run inline.
+void thread_pool_parallel_for(ThreadPool* pool, ThreadPoolJob job, void* context, const size_t item_count, const size_t chunk_size);
+
+#endif // #ifndef THREAD_POOL_H
@@ -0,0 +1,106 @@
+#include "vmem.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+static size_t _align_up(size_t size, size_t alignment);
+
+int vmem_reserve(VirtualRange* o_range, const size_t size, const int huge_pages) {
+    memset(o_range, 0, sizeof(VirtualRange));
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t granularity = huge_pages ? HUGE_PAGE_SIZE : page_size;
+    const size_t reserved = _align_up(size > 0 ? size : 1, granularity);
+
+    // huge pages are only used for naturally aligned regions, so reserve
+    // enough slack to line the range up and hand the rest back
+    const size_t slack = huge_pages ? HUGE_PAGE_SIZE : 0;
+    unsigned char* mapping = mmap(NULL, reserved + slack, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: failed to reserve %zu bytes (%s)\n", reserved, strerror(errno));
+        return 0;
+    }
+
+    unsigned char* base = (unsigned char*)_align_up((uintptr_t)mapping, granularity);
+    if (base > mapping)
+        munmap(mapping, base - mapping);
+    if (slack > (size_t)(base - mapping))
+        munmap(base + reserved, slack - (base - mapping));
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages && madvise(base, reserved, MADV_HUGEPAGE) != 0)
+        fprintf(stderr, "WARNING: transparent huge pages unavailable (%s)\n", strerror(errno));
+#else
+    if (huge_pages)
+        fprintf(stderr, "WARNING: transparent huge pages aren't supported on this platform\n");
+#endif
+
+    o_range->base = base;
+    o_range->reserved = reserved;
+    o_range->granularity = granularity;
+    return 1;
+}
+
+int vmem_commit(VirtualRange* range, const size_t size) {
+    if (size <= range->committed)
+        return 1;
+
+    if (size > range->reserved)
+        return 0;
+
+    const size_t committed = _align_up(size, range->granularity);
+    if (mprotect(range->base + range->committed, committed - range->committed, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "ERROR: failed to commit %zu bytes (%s)\n", committed, strerror(errno));
+        return 0;
+    }
+
+    range->committed = committed;
+    return 1;
+}
+
+int vmem_map_file(VirtualRange* range, const int fd, const size_t offset, const size_t size) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (range->committed != 0 || size > range->reserved || offset % page_size != 0)
+        return 0;
+
+    if (size == 0)
+        return 1;
+
+    // MAP_FIXED swaps the reserved pages for the file's in place, so the base
+    // stays where it was
+    const size_t mapped = _align_up(size, page_size);
+    void* mapping = mmap(range->base, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: failed to map %zu bytes of file (%s)\n", mapped, strerror(errno));
+        return 0;
+    }
+
+    range->committed = mapped;
+    return 1;
+}
+
+void vmem_release(VirtualRange* range) {
+    if (range->base != NULL)
+        munmap(range->base, range->reserved);
+
+    memset(range, 0, sizeof(VirtualRange));
+}
+
+static size_t _align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
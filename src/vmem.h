@@ -0,0 +1,34 @@
+#ifndef VMEM_H
+#define VMEM_H
+
+#include <stdlib.h>
+
+// a contiguous range of address space that's reserved up front and backed by
+// memory lazily. the base never moves, so pointers into the range stay valid
+// as it grows, and pages that were never committed cost nothing.
+typedef struct {
+    unsigned char*  base;
+    size_t          reserved;
+    size_t          committed;
+    size_t          granularity;
+} VirtualRange;
+
+// reserves at least size bytes without committing any. with huge_pages the
+// range is aligned and committed in huge page steps and advised for
+// transparent huge pages, where the platform supports them. returns 0 on failure
+int vmem_reserve(VirtualRange* o_range, const size_t size, const int huge_pages);
+
+// makes sure the first size bytes are readable and writable. freshly
+// committed memory reads as zero. returns 0 if size is past the reservation
+int vmem_commit(VirtualRange* range, const size_t size);
+
+// maps size bytes of fd, starting at offset, copy on write over the start of
+// a range with nothing committed yet. pages are read in from the file as they
+// are first touched and writes never reach the file. offset has to be page
+// aligned and the file has to cover every page the mapping touches. returns 0
+// on failure
+int vmem_map_file(VirtualRange* range, const int fd, const size_t offset, const size_t size);
+
+void vmem_release(VirtualRange* range);
+
+#endif // #ifndef VMEM_H